@@ -27,8 +27,15 @@ using vhdl::Generic;
 
 namespace fletchgen {
 
-ColumnWrapper::ColumnWrapper(std::shared_ptr<arrow::Schema> schema, string name, string acc_name, int num_user_regs)
-    : StreamComponent(std::move(name)), schema_(std::move(schema)), user_regs_(num_user_regs) {
+ColumnWrapper::ColumnWrapper(std::shared_ptr<arrow::Schema> schema,
+                             string name,
+                             string acc_name,
+                             int num_user_regs,
+                             bool perf_counters)
+    : StreamComponent(std::move(name)),
+      schema_(std::move(schema)),
+      user_regs_(num_user_regs),
+      perf_counters_(perf_counters) {
 
   /* Generics */
   addGenerics();
@@ -71,6 +78,11 @@ ColumnWrapper::ColumnWrapper(std::shared_ptr<arrow::Schema> schema, string name,
 
   addControllerSignals();
 
+  /* Performance counters */
+  if (perf_counters_) {
+    addPerfCounters();
+  }
+
   /* Internal connections */
   connectUserCoreStreams();
   connectGlobalPorts();
@@ -342,9 +354,19 @@ int ColumnWrapper::countRegisters() {
   reg_count += 2 * countBuffers(); // Buffer addresses
   reg_count += user_regs_;         // User registers.
 
+  if (perf_counters_) {
+    // Align the counters, such that every counter can be read as one 64-bit register
+    reg_count += (ce::REGS_PER_COUNTER - reg_count % ce::REGS_PER_COUNTER) % ce::REGS_PER_COUNTER;
+    reg_count += PerfCounters::countRegisters(countColumnsOfMode(Mode::READ));
+  }
+
   return reg_count;
 }
 
+int ColumnWrapper::counter_offset() {
+  return countRegisters() - PerfCounters::countRegisters(countColumnsOfMode(Mode::READ));
+}
+
 void ColumnWrapper::connectReadRequestChannels() {
   // First find all the column bus signals
   int offset = 0;
@@ -515,6 +537,9 @@ void ColumnWrapper::connectGlobalPorts() {
   connectGlobalPortsOf(arbiter_inst_.get());
   connectGlobalPortsOf(uctrl_inst_.get());
   connectGlobalPortsOf(usercore_inst_.get());
+  if (perf_inst_ != nullptr) {
+    connectGlobalPortsOf(perf_inst_.get());
+  }
 }
 
 void ColumnWrapper::connectControllerRegs() {
@@ -570,8 +595,14 @@ void ColumnWrapper::implementUserRegs() {
     usercore_inst_->mapPort(usercore_->user_regs_out_en(), sroute);
     sgroup_++;
 
-    Range rr = Range(Value("NUM_REGS*REG_WIDTH") - Value(1), (Value("(NUM_REGS-NUM_USER_REGS)*REG_WIDTH")));
-    Range wer = Range(Value("NUM_REGS") - Value(1), Value("NUM_REGS-NUM_USER_REGS"));
+    // User registers are at the top of the register file, below the performance counters, if any.
+    string top = "NUM_REGS";
+    if (perf_counters_) {
+      top = "(NUM_REGS-" + std::to_string(PerfCounters::countRegisters(countColumnsOfMode(Mode::READ))) + ")";
+    }
+
+    Range rr = Range(Value(top + "*REG_WIDTH") - Value(1), (Value("(" + top + "-NUM_USER_REGS)*REG_WIDTH")));
+    Range wer = Range(Value(top) - Value(1), Value(top + "-NUM_USER_REGS"));
 
     architecture()->addConnection(make_shared<Connection>(regs_in(), rr, srin, Range()));
     architecture()->addConnection(make_shared<Connection>(srout, Range(), regs_out(), rr));
@@ -590,6 +621,45 @@ void ColumnWrapper::implementUserRegs() {
   }
 }
 
+void ColumnWrapper::addPerfCounters() {
+  auto num_readers = countColumnsOfMode(Mode::READ);
+  auto num_regs = PerfCounters::countRegisters(num_readers);
+  auto offset = counter_offset();
+
+  perf_ = make_shared<PerfCounters>(num_readers);
+  perf_inst_ = make_shared<Instantiation>(nameFrom({perf_->entity()->name(), "inst"}),
+                                          std::static_pointer_cast<Component>(perf_));
+  architecture()->addInstantiation(perf_inst_);
+  perf_inst_->setComment(
+      t(1) + "-- Performance counters of " + std::to_string(num_readers) + " column readers.\n" +
+      t(1) + "-- Registers " + std::to_string(offset) + " to " + std::to_string(offset + num_regs - 1) +
+      ", or 64-bit register " + std::to_string(offset / ce::REGS_PER_COUNTER) + " onwards from the host.\n"
+  );
+
+  perf_inst_->mapGeneric(perf_->entity()->getGenericByName("NUM_SLAVE_PORTS"), Value(num_readers));
+  perf_inst_->mapGeneric(perf_->entity()->getGenericByName(ce::BUS_DATA_WIDTH), Value(ce::BUS_DATA_WIDTH));
+  perf_inst_->mapGeneric(perf_->entity()->getGenericByName(ce::REG_WIDTH), Value(ce::REG_WIDTH));
+
+  perf_inst_->mapPort(perf_->start(), architecture()->getSignal("uctrl_start"));
+  perf_inst_->mapPort(perf_->busy(), architecture()->getSignal("uctrl_busy"));
+
+  // Observe the handshakes between the column readers and the arbiter
+  std::vector<std::shared_ptr<StreamPort>> arb_ports = arbiter_->slv_rreq()->ports();
+  auto rdat_ports = arbiter_->slv_rdat()->ports();
+  arb_ports.insert(arb_ports.end(), rdat_ports.begin(), rdat_ports.end());
+  for (const auto &p : arb_ports) {
+    auto perf_port = perf_->entity()->getPortByName(p->name());
+    if (perf_port != nullptr) {
+      perf_inst_->mapPort(perf_port, architecture()->getSignal(nameFrom({vhdl::INT_SIG, p->name()})));
+    }
+  }
+
+  Range rr(Value("NUM_REGS*REG_WIDTH") - Value(1), Value("(NUM_REGS-" + std::to_string(num_regs) + ")*REG_WIDTH"));
+  Range wer(Value("NUM_REGS") - Value(1), Value("NUM_REGS-" + std::to_string(num_regs)));
+  perf_inst_->mapPort(perf_->counters(), regs_out(), rr);
+  perf_inst_->mapPort(perf_->counters_en(), regs_out_en(), wer);
+}
+
 GeneralPort *ColumnWrapper::regs_in() {
   return dynamic_cast<GeneralPort *>(entity()->getPortByName("regs_in"));
 }
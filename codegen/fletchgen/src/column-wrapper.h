@@ -49,7 +49,8 @@ class ColumnWrapper : public StreamComponent {
   explicit ColumnWrapper(std::shared_ptr<arrow::Schema> schema,
                          std::string name,
                          std::string acc_name,
-                         int num_user_regs = 0);
+                         int num_user_regs = 0,
+                         bool perf_counters = false);
 
   /// @brief Return the schema this wrapper implementation is derived from.
   std::shared_ptr<arrow::Schema> schema() { return schema_; }
@@ -77,9 +78,16 @@ class ColumnWrapper : public StreamComponent {
   /// @brief Return the number of user registers.
   int user_regs() { return user_regs_; }
 
+  /// @brief Return true if this wrapper has a performance counter block.
+  bool perf_counters() { return perf_counters_; }
+
+  /// @brief Return the index of the first performance counter register.
+  int counter_offset();
+
  private:
   std::shared_ptr<arrow::Schema> schema_ = nullptr; ///< The schema this wrapper implementation is derived from.
   int user_regs_ = 0; ///< Amount of registers for the UserCore
+  bool perf_counters_ = false; ///< Whether to generate performance counters
 
   std::shared_ptr<UserCore> usercore_; ///< UserCore component that has to be implemented by the user.
   std::shared_ptr<Instantiation> usercore_inst_; ///< UserCore instance.
@@ -90,6 +98,9 @@ class ColumnWrapper : public StreamComponent {
   std::shared_ptr<ReadArbiter> arbiter_; ///< Arbiter component.
   std::shared_ptr<Instantiation> arbiter_inst_; ///< Arbiter instance.
 
+  std::shared_ptr<PerfCounters> perf_; ///< Performance counters component, if any.
+  std::shared_ptr<Instantiation> perf_inst_; ///< Performance counters instance.
+
   GeneralPort *regs_in();;
 
   GeneralPort *regs_out();;
@@ -171,6 +182,9 @@ class ColumnWrapper : public StreamComponent {
 
   void implementUserRegs();
 
+  /// @brief Add the performance counters and map them to the top registers.
+  void addPerfCounters();
+
   void addArbiter();
 
   void mapUserGenerics();
@@ -69,12 +69,14 @@ std::vector<T *> ptrvec(std::vector<std::shared_ptr<T>> vec) {
 /**
  * Generate a VHDL wrapper on an output stream.
  * @param schema The schema to base the wrapper on.
+ * @param perf_counters Whether to generate a performance counter block.
  * @return The column wrapper
  */
 std::shared_ptr<ColumnWrapper> generateColumnWrapper(const std::vector<std::ostream *> &outputs,
                                                      const std::shared_ptr<arrow::Schema> &schema,
                                                      const std::string &acc_name,
                                                      const std::string &wrap_name,
-                                                     int user_regs);
+                                                     int user_regs,
+                                                     bool perf_counters = false);
 
 }//namespace fletchgen
\ No newline at end of file
@@ -80,5 +80,10 @@ constexpr char ACC_RST[] = "acc_reset";
 constexpr char NUM_USER_REGS[] = "NUM_USER_REGS";
 constexpr int REGS_PER_ADDRESS = BUS_ADDR_WIDTH_DEFAULT / REG_WIDTH_DEFAULT;
 
+// Performance counters are 64 bits wide
+constexpr int REGS_PER_COUNTER = 64 / REG_WIDTH_DEFAULT;
+// Bytes read, request stall cycles, data stall cycles and arbiter grants
+constexpr int COUNTERS_PER_READER = 4;
+
 } //namespace ce
 } //namespace fletchgen
@@ -52,6 +52,7 @@ int main(int argc, char **argv) {
   std::string acc_name;
   std::string wrap_name;
   int regs = 0;
+  bool perf_counters = false;
 
   /* Parse command-line options: */
   namespace po = boost::program_options;
@@ -64,6 +65,9 @@ int main(int argc, char **argv) {
       ("name,n", po::value<std::string>()->default_value("<input file name>"), "Name of the accelerator component.")
       ("wrapper_name,w", po::value<std::string>()->default_value("fletcher_wrapper"), "Name of the wrapper component.")
       ("custom_registers,r", po::value<int>(), "Number 32-bit registers in accelerator component.")
+      ("perf_counters,p",
+         "Generate performance counters at the top of the register file, counting busy cycles and, "
+         "for every column reader, bytes read, request and data stall cycles and arbiter grants.")
       ("recordbatch_data,d", po::value<std::string>(), "RecordBatch data input file name for SREC generation.")
       ("recordbatch_schema,s", po::value<std::string>(), "RecordBatch schema input file name for SREC generation.")
       ("srec_output,x", po::value<std::string>(),
@@ -150,6 +154,11 @@ int main(int argc, char **argv) {
     regs = vm["custom_registers"].as<int>();
   }
 
+  // Performance counters:
+  if (vm.count("perf_counters")) {
+    perf_counters = true;
+  }
+
   std::vector<std::ostream *> outputs;
 
   /* Determine output streams */
@@ -164,9 +173,13 @@ int main(int argc, char **argv) {
     outputs.push_back(&ofs);
   }
 
-  auto wrapper = fletchgen::generateColumnWrapper(outputs, fletchgen::readSchemaFromFile(schema_fname), acc_name, wrap_name, regs);
+  auto wrapper = fletchgen::generateColumnWrapper(outputs, fletchgen::readSchemaFromFile(schema_fname), acc_name, wrap_name, regs, perf_counters);
   LOGD("Wrapper generation finished.");
 
+  if (perf_counters) {
+    LOGD("Performance counters start at register " + std::to_string(wrapper->counter_offset()) + ".");
+  }
+
   /* AXI top level */
   if (vm.count("axi")) {
     auto axi_file = vm["axi"].as<std::string>();
@@ -62,4 +62,45 @@ UserCoreController::UserCoreController() : Component("UserCoreController") {
       ->addGeneric(std::make_shared<vhdl::Generic>(ce::REG_WIDTH, "natural", Value(ce::REG_WIDTH_DEFAULT)));
 }
 
+PerfCounters::PerfCounters(int num_readers) : Component("PerfCounters") {
+  entity()->addPort(std::make_shared<GeneralPort>(ce::BUS_CLK, GP::BUS_CLK, Dir::IN), 0);
+  entity()->addPort(std::make_shared<GeneralPort>(ce::BUS_RST, GP::BUS_RESET, Dir::IN), 0);
+
+  start_ = std::make_shared<GeneralPort>("start", GP::SIG, Dir::IN);
+  busy_ = std::make_shared<GeneralPort>("busy", GP::SIG, Dir::IN);
+
+  entity()->addPort(start_, 1);
+  entity()->addPort(busy_, 1);
+
+  // Handshake signals of the arbiter slave ports
+  Value hs_width = Value(num_readers);
+  entity()->addPort(std::make_shared<GeneralPort>("bsv_rreq_valid", GP::SIG, Dir::IN, hs_width), 2);
+  entity()->addPort(std::make_shared<GeneralPort>("bsv_rreq_ready", GP::SIG, Dir::IN, hs_width), 2);
+  entity()->addPort(std::make_shared<GeneralPort>("bsv_rdat_valid", GP::SIG, Dir::IN, hs_width), 2);
+  entity()->addPort(std::make_shared<GeneralPort>("bsv_rdat_ready", GP::SIG, Dir::IN, hs_width), 2);
+
+  counters_ = std::make_shared<GeneralPort>("counters",
+                                            GP::REG,
+                                            Dir::OUT,
+                                            Value(countRegisters(num_readers)) * Value(ce::REG_WIDTH));
+  counters_en_ = std::make_shared<GeneralPort>("counters_en", GP::REG, Dir::OUT, Value(countRegisters(num_readers)));
+  entity()->addPort(counters_, 3);
+  entity()->addPort(counters_en_, 3);
+
+  entity()->addGeneric(std::make_shared<vhdl::Generic>("NUM_SLAVE_PORTS", "natural", Value(1)));
+  entity()->addGeneric(std::make_shared<vhdl::Generic>(ce::BUS_DATA_WIDTH,
+                                                       "natural",
+                                                       Value(ce::BUS_DATA_WIDTH_DEFAULT)));
+  entity()
+      ->addGeneric(std::make_shared<vhdl::Generic>(ce::REG_WIDTH, "natural", Value(ce::REG_WIDTH_DEFAULT)));
+}
+
+int PerfCounters::countCounters(int num_readers) {
+  return 1 + ce::COUNTERS_PER_READER * num_readers;
+}
+
+int PerfCounters::countRegisters(int num_readers) {
+  return ce::REGS_PER_COUNTER * countCounters(num_readers);
+}
+
 }
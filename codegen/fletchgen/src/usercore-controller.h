@@ -53,4 +53,36 @@ class UserCoreController : public Component {
   std::shared_ptr<GeneralPort> done_;
 };
 
+/**
+ * @brief Performance counters of a wrapper.
+ *
+ * Counts the cycles the UserCore is busy, and for every column reader the
+ * bytes read, the request and data stall cycles and the requests granted
+ * by the arbiter. The counters are cleared when the UserCore is started.
+ */
+class PerfCounters : public Component {
+ public:
+  explicit PerfCounters(int num_readers);
+
+  /// @brief Return the number of 64-bit counters.
+  static int countCounters(int num_readers);
+
+  /// @brief Return the number of registers occupied by the counters.
+  static int countRegisters(int num_readers);
+
+  Port *start() { return start_.get(); }
+
+  Port *busy() { return busy_.get(); }
+
+  Port *counters() { return counters_.get(); }
+
+  Port *counters_en() { return counters_en_.get(); }
+
+ private:
+  std::shared_ptr<GeneralPort> start_;
+  std::shared_ptr<GeneralPort> busy_;
+  std::shared_ptr<GeneralPort> counters_;
+  std::shared_ptr<GeneralPort> counters_en_;
+};
+
 }//namespace fletchgen
\ No newline at end of file
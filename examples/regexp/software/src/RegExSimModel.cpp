@@ -0,0 +1,98 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdexcept>
+
+#include "RegExSimModel.h"
+
+using namespace fletcher;
+
+RegExSimModel::RegExSimModel(const std::vector<std::string>& regexes)
+{
+  if (regexes.size() > REUC_TOTAL_UNITS) {
+    throw std::runtime_error("The RegEx units support at most 16 regular expressions.");
+  }
+
+  for (const auto& regex : regexes) {
+    programs.emplace_back(new re2::RE2(regex));
+  }
+}
+
+uint64_t RegExSimModel::run(std::vector<fr_t>& registers)
+{
+  /*
+   * The string column is not nullable, so the offsets and values buffers
+   * are followed directly by the first and last indices of every unit,
+   * which are packed two per register like in
+   * RegExUserCore::generate_unit_arguments.
+   */
+  auto offsets = reinterpret_cast<const int32_t*>(registers[UC_REG_BUFFERS]);
+  auto values = reinterpret_cast<const char*>(registers[UC_REG_BUFFERS + 1]);
+  uint64_t args = UC_REG_BUFFERS + 2;
+
+  std::vector<uint32_t> matches(REUC_TOTAL_UNITS, 0);
+  uint64_t bytes = 0;
+
+  for (int u = 0; u < REUC_ACTIVE_UNITS; u++) {
+    reg_conv_t first, last;
+    first.full = registers[args + u / 2];
+    last.full = registers[args + REUC_TOTAL_UNITS / 2 + u / 2];
+
+    uint32_t first_index = u % 2 == 0 ? first.half.hi : first.half.lo;
+    uint32_t last_index = u % 2 == 0 ? last.half.hi : last.half.lo;
+
+    for (uint32_t i = first_index; i < last_index; i++) {
+      re2::StringPiece str(values + offsets[i], static_cast<re2::StringPiece::size_type>(offsets[i + 1] - offsets[i]));
+      bytes += str.size() + sizeof(int32_t);
+
+      for (size_t p = 0; p < programs.size(); p++) {
+        if (re2::RE2::FullMatch(str, *programs[p])) {
+          matches[p]++;
+        }
+      }
+    }
+  }
+
+  // Two 32-bit match counters are packed in every result register
+  for (int p = 0; p < REUC_TOTAL_UNITS / 2; p++) {
+    reg_conv_t conv;
+    conv.half.hi = matches[2 * p];
+    conv.half.lo = matches[2 * p + 1];
+    registers[REUC_RESULT_OFFSET + p] = conv.full;
+  }
+
+  return bytes;
+}
+
+// These follow the settings in the RegExUserCore constructor
+
+fr_t RegExSimModel::control_start()
+{
+  return REUC_ACTIVE_UNITS == 16 ? 0x000000000000FFFF : 0x00000000000000FF;
+}
+
+fr_t RegExSimModel::control_reset()
+{
+  return REUC_ACTIVE_UNITS == 16 ? 0x00000000FFFF0000 : 0x000000000000FF00;
+}
+
+fr_t RegExSimModel::status_busy()
+{
+  return control_start();
+}
+
+fr_t RegExSimModel::status_done()
+{
+  return control_reset();
+}
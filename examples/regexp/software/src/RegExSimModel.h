@@ -0,0 +1,52 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <re2/re2.h>
+
+#include "fletcher/sim/sim.h"
+
+#include "RegExUserCore.h"
+
+/**
+ * \class RegExSimModel
+ *
+ * A functional model of the regular expression matching UserCore, to run
+ * the example on the SimPlatform.
+ */
+class RegExSimModel : public fletcher::SimModel
+{
+ public:
+  /**
+   * \param regexes The regular expressions the units match.
+   */
+  explicit RegExSimModel(const std::vector<std::string>& regexes);
+
+  uint64_t run(std::vector<fletcher::fr_t>& registers) override;
+
+  fletcher::fr_t control_start() override;
+  fletcher::fr_t control_reset() override;
+  fletcher::fr_t control_stop() override { return 0; }
+  fletcher::fr_t status_idle() override { return 0; }
+  fletcher::fr_t status_busy() override;
+  fletcher::fr_t status_done() override;
+
+ private:
+  std::vector<std::unique_ptr<re2::RE2>> programs;
+};
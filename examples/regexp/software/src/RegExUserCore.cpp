@@ -58,8 +58,9 @@ std::vector<fr_t> RegExUserCore::generate_unit_arguments(uint32_t first_index,
   uint32_t match_rows = last_index - first_index;
   for (int i = 0; i < REUC_ACTIVE_UNITS; i++) {
     // First and last index for unit i
+    // Rounding both ends the same way covers every row, whatever the number of rows
     uint32_t first = first_index + i * match_rows / REUC_ACTIVE_UNITS;
-    uint32_t last = first + match_rows / REUC_ACTIVE_UNITS;
+    uint32_t last = first_index + (i + 1) * match_rows / REUC_ACTIVE_UNITS;
     first_vec.push_back(first);
     last_vec.push_back(last);
   }
@@ -92,9 +93,30 @@ void RegExUserCore::get_matches(std::vector<uint32_t>& matches)
 {
   int np = matches.size();
 
+  // Two 32-bit match counters are packed in every register
+  std::vector<fr_t> regs(np / 2);
+  this->platform()->read_mmio_batch(this->window() + REUC_RESULT_OFFSET, regs.data(), regs.size());
+
+  for (int p = 0; p < np / 2; p++) {
+    reg_conv_t conv;
+    conv.full = regs[p];
+    matches[2 * p] += conv.half.hi;
+    matches[2 * p + 1] += conv.half.lo;
+  }
+}
+
+void RegExUserCore::get_matches(const CompletionRecord& record, std::vector<uint32_t>& matches)
+{
+  int np = matches.size();
+
+  if (record.results.size() < (size_t) np / 2) {
+    throw std::runtime_error("Completion record holds too few match counters.");
+  }
+
+  // The record holds the same registers as the result registers
   for (int p = 0; p < np / 2; p++) {
     reg_conv_t conv;
-    this->platform()->read_mmio(REUC_RESULT_OFFSET + p, &conv.full);
+    conv.full = record.results[p];
     matches[2 * p] += conv.half.hi;
     matches[2 * p + 1] += conv.half.lo;
   }
@@ -18,6 +18,7 @@
 
 #include "fletcher/FPGAPlatform.h"
 #include "fletcher/UserCore.h"
+#include "fletcher/CommandRing.h"
 
 #define REUC_TOTAL_UNITS   16
 #define REUC_RESULT_OFFSET 21
@@ -51,11 +52,17 @@ class RegExUserCore : public fletcher::UserCore
    * \brief Get the number of matches from the RegEx units.
    */
   void get_matches(std::vector<uint32_t>& matches);
- private:
+
   /**
-   * \brief Generate arguments for each of the RegEx units.
+   * \brief Get the number of matches from the completion record of a
+   * command, for a CommandRing with completions enabled at
+   * REUC_RESULT_OFFSET and REUC_TOTAL_UNITS / 2 results.
    */
-  std::vector<fletcher::fr_t> generate_unit_arguments(uint32_t last_index,
-                                                      uint32_t first_index);
+  void get_matches(const fletcher::CompletionRecord& record, std::vector<uint32_t>& matches);
 
+  /**
+   * \brief Generate arguments for each of the RegEx units.
+   */
+  std::vector<fletcher::fr_t> generate_unit_arguments(uint32_t first_index,
+                                                      uint32_t last_index);
 };
@@ -15,16 +15,11 @@
 /**
  * Main file for the regular expression matching example application.
  *
- * This example works only under the following constraints:
- *
- * - The number of rows MUST be an integer multiple of the number of active
- *   units (due to naive work distribution)
- *
  * Output format (all times are in seconds):
  * - no. rows, no. bytes (all buffers), table fill time,
  *   C++ run time, C++ using Arrow run time,
  *   C++ using OpenMP run time, C++ using OpenMP and Arrow run time,
- *   FPGA Copy time, FPGA run time
+ *   FPGA Copy time, FPGA run time, CPU and FPGA (hybrid) run time
  *
  * TODO:
  * - Somehow, only on the Amazon instance on CentOS after using dev toolkit 6
@@ -57,6 +52,7 @@
 
 // RegEx FPGA UserCore
 #include "RegExUserCore.h"
+#include "RegExSimModel.h"
 
 #ifndef PLATFORM
 #define PLATFORM 0
@@ -143,7 +139,8 @@ void generate_strings(vector<string> &strings,
  */
 shared_ptr<arrow::Table> create_table(const vector<string> &strings) {
 
-  arrow::StringBuilder str_builder(arrow::default_memory_pool());
+  // Build the column directly into page-aligned memory the FPGA can access
+  arrow::StringBuilder str_builder(fletcher::dma_memory_pool());
 
   for (auto s : strings) {
     str_builder.Append(s);
@@ -359,6 +356,73 @@ uint32_t calc_sum(const vector<uint32_t> &values) {
   return static_cast<uint32_t>(accumulate(values.begin(), values.end(), 0.0));
 }
 
+/**
+ * Create the FPGA platform this example was built for.
+ */
+shared_ptr<fletcher::FPGAPlatform> create_platform(const vector<string> &regexes) {
+#if(PLATFORM == 0)
+  (void) regexes;
+  return std::make_shared<fletcher::EchoPlatform>();
+#elif(PLATFORM == 1)
+  (void) regexes;
+  return std::make_shared<fletcher::AWSPlatform>();
+#elif(PLATFORM == 2)
+  (void) regexes;
+  return std::make_shared<fletcher::SNAPPlatform>();
+#elif(PLATFORM == 3)
+  return std::make_shared<fletcher::SimPlatform>(std::make_shared<RegExSimModel>(regexes));
+#else
+#error "PLATFORM must be 0, 1, 2 or 3"
+#endif
+}
+
+/**
+ * Match regular expressions on the FPGA and on multiple cores at the same
+ * time, using an Arrow table as a source.
+ */
+void add_matches_hybrid(fletcher::HybridExecutor &hybrid,
+                        RegExUserCore &uc,
+                        const shared_ptr<arrow::Column> &column,
+                        const vector<string> &regexes,
+                        vector<uint32_t> &matches) {
+  auto np = regexes.size();
+
+  // RE2 objects may be used by multiple threads at once
+  auto programs = compile_regexes(regexes);
+
+  vector<vector<uint32_t>> thread_matches(hybrid.cpu_threads(), vector<uint32_t>(np, 0));
+
+  hybrid.run(1024,
+             [&uc](const fletcher::RowRange &range) {
+               return uc.generate_unit_arguments(static_cast<uint32_t>(range.first),
+                                                 static_cast<uint32_t>(range.last));
+             },
+             [&uc, &matches](fletcher::UserCore &, const fletcher::RowRange &) {
+               uc.get_matches(matches);
+             },
+             [&column, &programs, &thread_matches, np](size_t t, const fletcher::RowRange &range) {
+               auto sa = std::static_pointer_cast<arrow::StringArray>(column->data()->chunk(range.chunk));
+               for (int64_t i = range.first; i < range.last; i++) {
+                 int length;
+                 const char *str = (const char *) sa->GetValue(i, &length);
+                 re2::StringPiece strpiece(str, static_cast<re2::StringPiece::size_type>(length));
+                 for (size_t p = 0; p < np; p++) {
+                   if (re2::RE2::FullMatch(strpiece, *programs[p])) {
+                     thread_matches[t][p]++;
+                   }
+                 }
+               }
+             });
+
+  for (const auto &tm : thread_matches) {
+    for (size_t p = 0; p < np; p++) {
+      matches[p] += tm[p];
+    }
+  }
+
+  clear_programs(programs);
+}
+
 /**
  * Main function for the regular expression matching example
  */
@@ -445,6 +509,7 @@ int main(int argc, char **argv) {
   vector<double> t_aomp(static_cast<unsigned long>(ne), 0.0);
   vector<double> t_copy(static_cast<unsigned long>(ne), 0.0);
   vector<double> t_fpga(static_cast<unsigned long>(ne), 0.0);
+  vector<double> t_hybr(static_cast<unsigned long>(ne), 0.0);
 
   auto np = static_cast<int>(regexes.size());
 
@@ -454,6 +519,7 @@ int main(int argc, char **argv) {
   vector<vector<uint32_t>> m_acpu(static_cast<unsigned long>(ne), vector<uint32_t>(np, 0));
   vector<vector<uint32_t>> m_aomp(static_cast<unsigned long>(ne), vector<uint32_t>(np, 0));
   vector<vector<uint32_t>> m_fpga(static_cast<unsigned long>(ne), vector<uint32_t>(np, 0));
+  vector<vector<uint32_t>> m_hybr(static_cast<unsigned long>(ne), vector<uint32_t>(np, 0));
 
   uint32_t first_index = 0;
   uint32_t last_index = num_rows;
@@ -485,6 +551,11 @@ int main(int argc, char **argv) {
 
   PRINT_TIME(t_ser);
 
+  // The hybrid executor learns from every experiment
+  shared_ptr<fletcher::FPGAPlatform> hybrid_platform;
+  shared_ptr<RegExUserCore> hybrid_uc;
+  shared_ptr<fletcher::HybridExecutor> hybrid;
+
   // Repeat the experiment
   for (int e = 0; e < ne; e++) {
 
@@ -523,15 +594,7 @@ int main(int argc, char **argv) {
     // Match on FPGA
     if (emask & 16u) {
       // Create a platform
-#if(PLATFORM == 0)
-      shared_ptr<fletcher::EchoPlatform> platform(new fletcher::EchoPlatform());
-#elif(PLATFORM == 1)
-      shared_ptr<fletcher::AWSPlatform> platform(new fletcher::AWSPlatform());
-#elif(PLATFORM == 2)
-      shared_ptr<fletcher::SNAPPlatform> platform(new fletcher::SNAPPlatform());
-#else
-#error "PLATFORM must be 0, 1 or 2"
-#endif
+      auto platform = create_platform(regexes);
 
       // Prepare the colummn buffers
       start = omp_get_wtime();
@@ -540,7 +603,7 @@ int main(int argc, char **argv) {
       t_copy[e] = (stop - start);
 
       // Create a UserCore
-      RegExUserCore uc(std::static_pointer_cast<fletcher::FPGAPlatform>(platform));
+      RegExUserCore uc(platform);
 
       // Reset it
       uc.reset();
@@ -561,6 +624,21 @@ int main(int argc, char **argv) {
       stop = omp_get_wtime();
       t_fpga[e] = (stop - start);
     }
+
+    // Match on CPU and FPGA at the same time, dividing the work by the throughput of previous experiments
+    if (emask & 32u) {
+      if (!hybrid) {
+        hybrid_platform = create_platform(regexes);
+        hybrid_platform->prepare_column_chunks(table->column(0));
+        hybrid_uc = std::make_shared<RegExUserCore>(hybrid_platform);
+        hybrid = std::make_shared<fletcher::HybridExecutor>(hybrid_platform, *hybrid_uc, num_threads);
+      }
+
+      start = omp_get_wtime();
+      add_matches_hybrid(*hybrid, *hybrid_uc, table->column(0), regexes, m_hybr[e]);
+      stop = omp_get_wtime();
+      t_hybr[e] = (stop - start);
+    }
   }
 
   PRINT_INT(bytes_copied);
@@ -572,6 +650,7 @@ int main(int argc, char **argv) {
   PRINT_TIME(calc_sum(t_aomp));
   PRINT_TIME(calc_sum(t_copy));
   PRINT_TIME(calc_sum(t_fpga));
+  PRINT_TIME(calc_sum(t_hybr));
 
   // Report other settings
   PRINT_INT(ne);
@@ -589,6 +668,7 @@ int main(int argc, char **argv) {
   vector<uint32_t> a_acpu(np, 0);
   vector<uint32_t> a_aomp(np, 0);
   vector<uint32_t> a_fpga(np, 0);
+  vector<uint32_t> a_hybr(np, 0);
 
   for (int p = 0; p < np; p++) {
     for (int e = 0; e < ne; e++) {
@@ -597,6 +677,7 @@ int main(int argc, char **argv) {
       a_acpu[p] += m_acpu[e][p];
       a_aomp[p] += m_aomp[e][p];
       a_fpga[p] += m_fpga[e][p];
+      a_hybr[p] += m_hybr[e][p];
     }
   }
 
@@ -607,7 +688,7 @@ int main(int argc, char **argv) {
 
   // Check if matches are equal
   if ((a_vcpu == a_vomp) && (a_vomp == a_acpu) && (a_acpu == a_aomp)
-      && (a_aomp == a_fpga)) {
+      && (a_aomp == a_fpga) && (!(emask & 32u) || (a_aomp == a_hybr))) {
     std::cout << "PASS";
   } else {
     std::cout << "ERROR";
@@ -0,0 +1,108 @@
+-- Copyright 2018 Delft University of Technology
+--
+-- Licensed under the Apache License, Version 2.0 (the "License");
+-- you may not use this file except in compliance with the License.
+-- You may obtain a copy of the License at
+--
+--     http://www.apache.org/licenses/LICENSE-2.0
+--
+-- Unless required by applicable law or agreed to in writing, software
+-- distributed under the License is distributed on an "AS IS" BASIS,
+-- WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+-- See the License for the specific language governing permissions and
+-- limitations under the License.
+
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+
+-- Performance counters of a wrapper. All counters are 64 bits wide and are
+-- cleared when the UserCore is started. The counters are, in order:
+--
+--   0         : cycles the UserCore is busy
+--   1 + 4*i   : bytes read by column reader i
+--   2 + 4*i   : cycles a read request of reader i is not accepted
+--   3 + 4*i   : cycles read data for reader i is not accepted by the reader
+--   4 + 4*i   : read requests of reader i granted by the arbiter
+--
+-- Every counter occupies two registers on the counters output, most
+-- significant word first, such that a host reading a 64-bit register
+-- obtains the complete counter. The counter registers are always enabled
+-- for writing.
+entity PerfCounters is
+  generic (
+    NUM_SLAVE_PORTS           : natural := 1;
+    BUS_DATA_WIDTH            : natural := 32;
+    REG_WIDTH                 : natural := 32
+  );
+  port (
+    bus_clk                   : in  std_logic;
+    bus_reset                 : in  std_logic;
+    start                     : in  std_logic;
+    busy                      : in  std_logic;
+    bsv_rreq_valid            : in  std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    bsv_rreq_ready            : in  std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    bsv_rdat_valid            : in  std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    bsv_rdat_ready            : in  std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    counters                  : out std_logic_vector((1+4*NUM_SLAVE_PORTS)*2*REG_WIDTH-1 downto 0);
+    counters_en               : out std_logic_vector((1+4*NUM_SLAVE_PORTS)*2-1 downto 0)
+  );
+end PerfCounters;
+
+architecture Behavioral of PerfCounters is
+
+  constant NUM_COUNTERS       : natural := 1 + 4 * NUM_SLAVE_PORTS;
+  constant BYTES_PER_BEAT     : natural := BUS_DATA_WIDTH / 8;
+
+  type counter_array is array (natural range <>) of unsigned(2*REG_WIDTH-1 downto 0);
+
+  signal count                : counter_array(0 to NUM_COUNTERS-1);
+  signal start_r              : std_logic;
+
+begin
+
+  count_proc: process(bus_clk) is
+  begin
+    if rising_edge(bus_clk) then
+      start_r <= start;
+
+      if busy = '1' then
+        count(0) <= count(0) + 1;
+      end if;
+
+      for i in 0 to NUM_SLAVE_PORTS-1 loop
+        if bsv_rdat_valid(i) = '1' and bsv_rdat_ready(i) = '1' then
+          count(1+4*i) <= count(1+4*i) + BYTES_PER_BEAT;
+        end if;
+        if bsv_rreq_valid(i) = '1' and bsv_rreq_ready(i) = '0' then
+          count(2+4*i) <= count(2+4*i) + 1;
+        end if;
+        if bsv_rdat_valid(i) = '1' and bsv_rdat_ready(i) = '0' then
+          count(3+4*i) <= count(3+4*i) + 1;
+        end if;
+        if bsv_rreq_valid(i) = '1' and bsv_rreq_ready(i) = '1' then
+          count(4+4*i) <= count(4+4*i) + 1;
+        end if;
+      end loop;
+
+      -- Clear on the rising edge of start, so a run only counts itself
+      if bus_reset = '1' or (start = '1' and start_r = '0') then
+        count   <= (others => (others => '0'));
+      end if;
+
+      if bus_reset = '1' then
+        start_r <= '0';
+      end if;
+    end if;
+  end process;
+
+  counters_en <= (others => '1');
+
+  out_gen: for c in 0 to NUM_COUNTERS-1 generate
+    counters((2*c+1)*REG_WIDTH-1 downto 2*c*REG_WIDTH)
+      <= std_logic_vector(count(c)(2*REG_WIDTH-1 downto REG_WIDTH));
+    counters((2*c+2)*REG_WIDTH-1 downto (2*c+1)*REG_WIDTH)
+      <= std_logic_vector(count(c)(REG_WIDTH-1 downto 0));
+  end generate;
+
+end Behavioral;
@@ -42,6 +42,26 @@ package Wrapper is
     done                        : in std_logic
   );
   end component;
+
+  component PerfCounters is
+  generic (
+    NUM_SLAVE_PORTS             : natural := 1;
+    BUS_DATA_WIDTH              : natural := 32;
+    REG_WIDTH                   : natural := 32
+  );
+  port(
+    bus_clk                     : in std_logic;
+    bus_reset                   : in std_logic;
+    start                       : in std_logic;
+    busy                        : in std_logic;
+    bsv_rreq_valid              : in std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    bsv_rreq_ready              : in std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    bsv_rdat_valid              : in std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    bsv_rdat_ready              : in std_logic_vector(NUM_SLAVE_PORTS-1 downto 0);
+    counters                    : out std_logic_vector((1+4*NUM_SLAVE_PORTS)*2*REG_WIDTH-1 downto 0);
+    counters_en                 : out std_logic_vector((1+4*NUM_SLAVE_PORTS)*2-1 downto 0)
+  );
+  end component;
   
 end Wrapper;
 
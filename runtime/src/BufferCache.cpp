@@ -0,0 +1,229 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "logging.h"
+#include "BufferCache.h"
+
+namespace fletcher {
+
+BufferCache::BufferCache(DeviceMemory &memory, bool fingerprint)
+    : memory(memory), fingerprint(fingerprint) {}
+
+BufferCache::~BufferCache() {
+  std::lock_guard<std::mutex> guard(this->lock);
+  for (auto const &entry : this->entries) {
+    this->memory.free(entry.second.device);
+  }
+}
+
+bool BufferCache::acquire(const BufConfig &host, uint64_t alignment, fa_t *device) {
+  Key key = {host.address, host.size, 0, 0};
+
+  // Fingerprinting reads the whole buffer, do it outside of the lock.
+  if (this->fingerprint) {
+    key.fingerprint = compute_fingerprint(reinterpret_cast<const uint8_t *>(host.address), host.size);
+  }
+
+  std::unique_lock<std::mutex> guard(this->lock);
+
+  // Buffers that own their memory are temporary copies that can never be hit. An
+  // entry of the same key must belong to host memory that was freed.
+  bool transient = host.owner != nullptr;
+
+  auto hit = this->entries.end();
+  while (true) {
+    key.generation = this->generation;
+
+    hit = this->entries.find(key);
+    if (transient && (hit != this->entries.end())) {
+      if (hit->second.pins > 0) {
+        throw std::runtime_error("Host memory of a pinned buffer is in use by another buffer.");
+      }
+      remove(Key(key));
+      hit = this->entries.end();
+    }
+
+    if ((hit == this->entries.end()) || hit->second.valid) {
+      break;
+    }
+
+    // Another thread is copying the buffer. Look it up again afterwards, as a discarded copy is gone.
+    LOGD("[BufferCache] Waiting for " << host.name << " to be copied by another thread.");
+    this->settled.wait(guard);
+  }
+
+  if (hit != this->entries.end()) {
+    Entry &entry = hit->second;
+    entry.pins++;
+    this->lru.splice(this->lru.end(), this->lru, entry.lru);
+
+    this->_stats.hits++;
+    this->_stats.bytes_saved += host.size;
+
+    LOGD("[BufferCache] Hit: " << host.name << " at " << STRHEX64 << entry.device);
+
+    *device = entry.device;
+    return true;
+  }
+
+  // Allocate new device memory, evicting unused buffers until it fits.
+  fa_t address = 0;
+  while (this->memory.allocate((uint64_t) host.capacity, alignment, &address) != OK) {
+    if (!evict_one()) {
+      LOGE("[BufferCache] Device memory is exhausted by pinned buffers. Cannot allocate " << host.capacity
+                                                                                         << " bytes.");
+      throw std::runtime_error("Out of device memory.");
+    }
+  }
+
+  Entry entry;
+  entry.key = key;
+  entry.device = address;
+  entry.pins = 1;
+  entry.transient = transient;
+  entry.valid = false;
+  entry.lru = this->lru.insert(this->lru.end(), key);
+
+  this->entries[key] = entry;
+  this->by_device[address] = key;
+
+  this->_stats.misses++;
+
+  *device = address;
+  return false;
+}
+
+void BufferCache::validate(fa_t device) {
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto key = this->by_device.find(device);
+    if (key == this->by_device.end()) {
+      LOGE("[BufferCache] Attempt to validate unknown device buffer " << STRHEX64 << device);
+      return;
+    }
+    this->entries.at(key->second).valid = true;
+  }
+  this->settled.notify_all();
+}
+
+void BufferCache::release(fa_t device) {
+  std::lock_guard<std::mutex> guard(this->lock);
+
+  auto key = this->by_device.find(device);
+  if (key == this->by_device.end()) {
+    LOGE("[BufferCache] Attempt to release unknown device buffer " << STRHEX64 << device);
+    return;
+  }
+
+  Entry &entry = this->entries.at(key->second);
+  if (entry.pins > 0) {
+    entry.pins--;
+  }
+
+  // Buffers of an older generation and temporary buffers can never be hit again
+  if ((entry.pins == 0) && (entry.transient || (entry.key.generation != this->generation))) {
+    remove(Key(entry.key));
+  }
+}
+
+void BufferCache::discard(fa_t device) {
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+
+    auto key = this->by_device.find(device);
+    if (key != this->by_device.end()) {
+      remove(Key(key->second));
+    }
+  }
+  this->settled.notify_all();
+}
+
+void BufferCache::invalidate() {
+  std::lock_guard<std::mutex> guard(this->lock);
+
+  this->generation++;
+
+  std::vector<Key> unpinned;
+  for (auto const &entry : this->entries) {
+    if (entry.second.pins == 0) {
+      unpinned.push_back(entry.first);
+    }
+  }
+  for (auto const &key : unpinned) {
+    remove(key);
+  }
+}
+
+CacheStats BufferCache::stats() {
+  std::lock_guard<std::mutex> guard(this->lock);
+  return this->_stats;
+}
+
+bool BufferCache::evict_one() {
+  for (auto const &key : this->lru) {
+    if (this->entries.at(key).pins == 0) {
+      LOGD("[BufferCache] Evicting buffer at " << STRHEX64 << this->entries.at(key).device);
+      remove(Key(key));
+      this->_stats.evictions++;
+      return true;
+    }
+  }
+  return false;
+}
+
+void BufferCache::remove(const Key &key) {
+  auto it = this->entries.find(key);
+  if (it == this->entries.end()) {
+    return;
+  }
+  this->memory.free(it->second.device);
+  this->by_device.erase(it->second.device);
+  this->lru.erase(it->second.lru);
+  this->entries.erase(it);
+}
+
+uint64_t BufferCache::compute_fingerprint(const uint8_t *data, int64_t size) {
+  // 64-bit multiply-xorshift hash over 8-byte words
+  const uint64_t m = 0xC6A4A7935BD1E995UL;
+  uint64_t h = 0x8445D61A4E774912UL ^ ((uint64_t) size * m);
+
+  int64_t words = size / 8;
+  for (int64_t i = 0; i < words; i++) {
+    uint64_t k;
+    memcpy(&k, data + 8 * i, sizeof(k));
+    k *= m;
+    k ^= k >> 47;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  // Remaining bytes
+  uint64_t k = 0;
+  memcpy(&k, data + 8 * words, (size_t) (size - 8 * words));
+  h ^= k;
+  h *= m;
+
+  h ^= h >> 47;
+  h *= m;
+  h ^= h >> 47;
+  return h;
+}
+
+}
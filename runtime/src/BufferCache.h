@@ -0,0 +1,168 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "common.h"
+#include "DeviceMemory.h"
+
+namespace fletcher {
+
+/**
+ * Statistics of a BufferCache.
+ */
+typedef struct _CacheStats {
+  uint64_t hits = 0;         // Number of buffers found on the device
+  uint64_t misses = 0;       // Number of buffers that had to be copied
+  uint64_t evictions = 0;    // Number of buffers evicted to make room
+  uint64_t bytes_saved = 0;  // Number of bytes not copied because of hits
+} CacheStats;
+
+/**
+ * \class BufferCache
+ * \brief Cache of host buffers that are resident in device memory.
+ *
+ * Buffers are identified by their host address, size and the cache
+ * generation. Optionally, a fingerprint of the buffer contents is part of
+ * the key as well. Without fingerprints, the cache cannot see whether a
+ * host buffer was modified or whether its memory was freed and reused for
+ * another buffer of the same size; call invalidate() whenever that may have
+ * happened.
+ *
+ * Buffers in use by the device are pinned and are never evicted. Unpinned
+ * buffers stay resident until they are evicted in least-recently-used order
+ * when the device memory runs out. Host buffers that own their memory, such
+ * as the copies made for slices, are freed as soon as they are released,
+ * because their host memory is freed with them. All functions are
+ * thread-safe.
+ *
+ * A buffer that missed is in flight until its copy is validated or
+ * discarded. Other threads acquiring it meanwhile wait for that, such that
+ * they never use device memory that was not written yet.
+ */
+class BufferCache {
+ public:
+  /**
+   * \param memory      The device memory to allocate from.
+   * \param fingerprint Whether to include a fingerprint of the buffer
+   *                    contents in the key.
+   */
+  explicit BufferCache(DeviceMemory &memory, bool fingerprint = false);
+
+  ~BufferCache();
+
+  /**
+   * \brief Obtain device memory for a host buffer and pin it.
+   *
+   * \param host      The host buffer.
+   * \param alignment The alignment of the device address.
+   * \param device    The device address of the buffer.
+   * \return true if the buffer is already resident and need not be copied,
+   *         false if it must be copied to the newly allocated address,
+   *         after which validate() or discard() must be called.
+   *         Throws if no memory could be freed for the buffer.
+   */
+  bool acquire(const BufConfig &host, uint64_t alignment, fa_t *device);
+
+  /**
+   * \brief Mark a buffer that missed as copied, such that it can be hit.
+   */
+  void validate(fa_t device);
+
+  /**
+   * \brief Unpin a buffer obtained with acquire().
+   *
+   * The buffer stays resident until it is evicted.
+   */
+  void release(fa_t device);
+
+  /**
+   * \brief Drop a buffer obtained with acquire() from the cache, e.g.
+   * because copying it failed.
+   */
+  void discard(fa_t device);
+
+  /**
+   * \brief Start a new generation. Unpinned buffers of older generations
+   * are freed; pinned ones are freed when released.
+   */
+  void invalidate();
+
+  /**
+   * \brief Return the cache statistics.
+   */
+  CacheStats stats();
+
+ private:
+  typedef struct _Key {
+    fa_t host;
+    int64_t size;
+    uint64_t generation;
+    uint64_t fingerprint;
+
+    bool operator==(const _Key &other) const {
+      return (host == other.host) && (size == other.size) && (generation == other.generation)
+          && (fingerprint == other.fingerprint);
+    }
+  } Key;
+
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      return std::hash<uint64_t>()(k.host ^ (k.size * 0x9E3779B97F4A7C15UL) ^ (k.generation << 48) ^ k.fingerprint);
+    }
+  };
+
+  typedef struct _Entry {
+    Key key;
+    fa_t device;
+    unsigned int pins;
+    bool transient;
+    bool valid;  // false while the buffer is being copied
+    std::list<Key>::iterator lru;
+  } Entry;
+
+  DeviceMemory &memory;
+  bool fingerprint;
+
+  std::mutex lock;
+
+  /// Signalled when a buffer in flight is validated or discarded
+  std::condition_variable settled;
+
+  uint64_t generation = 0;
+
+  /// Least recently used unpinned buffers at the front
+  std::list<Key> lru;
+
+  std::unordered_map<Key, Entry, KeyHash> entries;
+  std::unordered_map<fa_t, Key> by_device;
+
+  CacheStats _stats;
+
+  /// Free the least recently used unpinned buffer. Returns false if there is none.
+  bool evict_one();
+
+  /// Remove an entry and free its device memory
+  void remove(const Key &key);
+
+  static uint64_t compute_fingerprint(const uint8_t *data, int64_t size);
+};
+
+}
@@ -0,0 +1,286 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include "logging.h"
+#include "CommandRing.h"
+
+namespace fletcher {
+
+CommandRing::CommandRing(std::shared_ptr<FPGAPlatform> platform,
+                         uint64_t reg_offset,
+                         size_t num_slots,
+                         size_t slot_words,
+                         uint64_t window)
+    : _platform(std::move(platform)),
+      reg_offset(window + reg_offset),
+      num_slots(num_slots),
+      slot_words(slot_words),
+      pool(false, true, _platform->numa_node()) {
+  // Writing the ring registers of a platform without a ring controller would clobber the UserCore registers
+  if (!this->_platform->command_ring_supported()) {
+    throw std::runtime_error("Platform " + this->_platform->name() + " does not support command rings.");
+  }
+
+  if ((num_slots == 0) || (slot_words < 2)) {
+    LOGE("[CommandRing] A ring needs at least one slot of two words. Entering error state.");
+    this->error = true;
+    return;
+  }
+
+  uint8_t *memory = nullptr;
+  auto status = this->pool.Allocate(static_cast<int64_t>(ring_bytes()), &memory);
+  if (!status.ok()) {
+    LOGE("[CommandRing] Could not allocate ring: " << status.ToString() << ". Entering error state.");
+    this->error = true;
+    return;
+  }
+  this->ring = reinterpret_cast<fr_t *>(memory);
+  memset(this->ring, 0, ring_bytes());
+
+  // Writing the base address resets the ring on the device
+  fr_t config[RING_REG_DOORBELL + 1];
+  config[RING_REG_BASE] = reinterpret_cast<fr_t>(this->ring);
+  config[RING_REG_SLOTS] = num_slots;
+  config[RING_REG_SLOT_WORDS] = slot_words;
+  config[RING_REG_DOORBELL] = 0;
+
+  if ((this->_platform->write_mmio_batch(this->reg_offset, config, RING_REG_DOORBELL + 1) != OK)
+      || (this->_platform->write_mmio(this->reg_offset + RING_REG_CQ_BASE, 0) != OK)) {
+    LOGE("[CommandRing] Could not configure ring. Entering error state.");
+    this->error = true;
+    return;
+  }
+
+  LOGD("[CommandRing] Ring of " << num_slots << " slots of " << slot_words << " words at " << STRHEX64
+                                << config[RING_REG_BASE] << ", registers at " << std::dec << this->reg_offset);
+}
+
+CommandRing::~CommandRing() {
+  if (this->ring != nullptr) {
+    // The device may still be fetching commands and writing records
+    if (!this->error && (this->submitted != this->_completed)) {
+      wait_all();
+    }
+    this->pool.Free(reinterpret_cast<uint8_t *>(this->ring), static_cast<int64_t>(ring_bytes()));
+  }
+  if (this->records != nullptr) {
+    this->pool.Free(reinterpret_cast<uint8_t *>(this->records), static_cast<int64_t>(ring_bytes()));
+  }
+}
+
+bool CommandRing::good() {
+  return !this->error;
+}
+
+int CommandRing::enable_completions(uint64_t result_offset, size_t num_results) {
+  if (this->error) {
+    return ERROR;
+  }
+
+  if (this->pushed != 0) {
+    throw std::runtime_error("Completion records must be enabled before the first command is pushed.");
+  }
+
+  // Polling for records that no controller writes would never complete
+  if (!this->_platform->command_ring_supported()) {
+    throw std::runtime_error("Platform " + this->_platform->name() + " does not write completion records.");
+  }
+
+  // The sequence number and return value come first
+  if (2 + num_results > this->slot_words) {
+    throw std::runtime_error("Completion record of " + std::to_string(num_results)
+                                 + " results does not fit in a slot of " + std::to_string(this->slot_words)
+                                 + " words.");
+  }
+
+  if (this->records == nullptr) {
+    uint8_t *memory = nullptr;
+    auto status = this->pool.Allocate(static_cast<int64_t>(ring_bytes()), &memory);
+    if (!status.ok()) {
+      LOGE("[CommandRing] Could not allocate completion records: " << status.ToString() << ".");
+      return ERROR;
+    }
+    this->records = reinterpret_cast<fr_t *>(memory);
+  }
+
+  // No record may look like it belongs to a command
+  memset(this->records, 0, ring_bytes());
+  this->num_results = num_results;
+
+  fr_t config[3];
+  config[RING_REG_CQ_BASE - RING_REG_CQ_BASE] = reinterpret_cast<fr_t>(this->records);
+  config[RING_REG_RESULTS - RING_REG_CQ_BASE] = result_offset;
+  config[RING_REG_NUM_RESULTS - RING_REG_CQ_BASE] = num_results;
+
+  if (this->_platform->write_mmio_batch(this->reg_offset + RING_REG_CQ_BASE, config, 3) != OK) {
+    LOGE("[CommandRing] Could not configure completion records. Entering error state.");
+    this->error = true;
+    return ERROR;
+  }
+
+  LOGD("[CommandRing] Completion records with " << num_results << " results at " << STRHEX64 << config[0]);
+
+  return OK;
+}
+
+uint64_t CommandRing::push(const std::vector<BufConfig> &buffers, const std::vector<fr_t> &arguments) {
+  if (this->error) {
+    throw std::runtime_error("Command ring is in error state.");
+  }
+
+  size_t count = buffers.size() + arguments.size();
+  if (count > this->slot_words - 1) {
+    throw std::runtime_error("Command of " + std::to_string(count) + " registers does not fit in a slot of "
+                                 + std::to_string(this->slot_words) + " words.");
+  }
+
+  // Wait for the device to free a slot
+  if (this->pushed - this->_completed == this->num_slots) {
+    // Commands that were pushed but not submitted would never free a slot
+    submit();
+    this->poller.wait([this]() -> bool {
+      return !update_completed() || (this->pushed - this->_completed < this->num_slots);
+    });
+    if (this->error) {
+      throw std::runtime_error("Could not read the consumed register of the command ring.");
+    }
+  }
+
+  fr_t *slot = &this->ring[(this->pushed % this->num_slots) * this->slot_words];
+
+  slot[0] = count;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    slot[1 + i] = buffers[i].address;
+  }
+  for (size_t i = 0; i < arguments.size(); i++) {
+    slot[1 + buffers.size() + i] = arguments[i];
+  }
+
+  return this->pushed++;
+}
+
+int CommandRing::submit() {
+  if (this->error) {
+    return ERROR;
+  }
+
+  if (this->submitted == this->pushed) {
+    return OK;
+  }
+
+  // The commands must be visible to the device before the doorbell is
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (this->_platform->write_mmio(this->reg_offset + RING_REG_DOORBELL, this->pushed) != OK) {
+    LOGE("[CommandRing] Could not ring the doorbell. Entering error state.");
+    this->error = true;
+    return ERROR;
+  }
+
+  LOGD("[CommandRing] Submitted commands " << this->submitted << " to " << this->pushed - 1);
+
+  this->submitted = this->pushed;
+
+  return OK;
+}
+
+CompletionRecord CommandRing::record(uint64_t sequence) {
+  if (this->records == nullptr) {
+    throw std::runtime_error("Completion records are not enabled.");
+  }
+
+  // The slot of the record may be reused by any command pushed after it
+  if ((sequence >= this->_completed) || (sequence + this->num_slots < this->pushed)) {
+    throw std::runtime_error("Completion record of command " + std::to_string(sequence) + " is not available.");
+  }
+
+  const volatile fr_t *slot = &this->records[(sequence % this->num_slots) * this->slot_words];
+
+  CompletionRecord record;
+  record.sequence = sequence;
+  record.return_value = slot[1];
+  for (size_t i = 0; i < this->num_results; i++) {
+    record.results.push_back(static_cast<fr_t>(slot[2 + i]));
+  }
+
+  return record;
+}
+
+uint64_t CommandRing::completed() {
+  update_completed();
+  return this->_completed;
+}
+
+uc_stat CommandRing::wait(uint64_t sequence) {
+  if (sequence >= this->submitted) {
+    throw std::runtime_error("Command " + std::to_string(sequence) + " was not submitted.");
+  }
+
+  if (sequence < this->_completed) {
+    return SUCCESS;
+  }
+
+  this->poller.start();
+  this->poller.wait([this, sequence]() -> bool {
+    return !update_completed() || (sequence < this->_completed);
+  });
+
+  return this->error ? FAILURE : SUCCESS;
+}
+
+uc_stat CommandRing::wait_all() {
+  if (this->submitted == 0) {
+    return SUCCESS;
+  }
+  return wait(this->submitted - 1);
+}
+
+bool CommandRing::update_completed() {
+  if (this->error) {
+    return false;
+  }
+
+  if (this->records != nullptr) {
+    // The device writes the sequence number of a record last, so the record is complete once it matches
+    while (this->_completed < this->submitted) {
+      const volatile fr_t *slot = &this->records[(this->_completed % this->num_slots) * this->slot_words];
+      if (slot[0] != this->_completed + 1) {
+        break;
+      }
+      this->_completed++;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+  }
+
+  fr_t consumed = 0;
+  if (this->_platform->read_mmio(this->reg_offset + RING_REG_CONSUMED, &consumed) != OK) {
+    LOGE("[CommandRing] Could not read the consumed register. Entering error state.");
+    this->error = true;
+    return false;
+  }
+
+  this->_completed = consumed;
+  return true;
+}
+
+size_t CommandRing::ring_bytes() {
+  return this->num_slots * this->slot_words * sizeof(fr_t);
+}
+
+}
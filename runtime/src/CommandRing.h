@@ -0,0 +1,205 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "DmaMemoryPool.h"
+#include "Poller.h"
+#include "UserCore.h"
+
+/// The registers of a command ring, relative to the ring register offset
+#define RING_REG_BASE        0  // Host address of the ring. Writing it resets the ring.
+#define RING_REG_SLOTS       1  // Number of slots
+#define RING_REG_SLOT_WORDS  2  // Number of 64-bit words per slot
+#define RING_REG_DOORBELL    3  // Number of commands submitted, written by the host
+#define RING_REG_CONSUMED    4  // Number of commands completed, written by the device
+#define RING_REG_CQ_BASE     5  // Host address of the completion records, or 0 if disabled
+#define RING_REG_RESULTS     6  // The first result register, relative to the register window
+#define RING_REG_NUM_RESULTS 7  // The number of result registers in a completion record
+#define RING_NUM_REGS        8
+
+#define RING_DEFAULT_SLOTS      64
+#define RING_DEFAULT_SLOT_WORDS 16  // 128 bytes, a cache line on POWER
+
+namespace fletcher {
+
+/**
+ * The completion record of a command.
+ */
+typedef struct _CompletionRecord {
+  uint64_t sequence = 0;      ///< The sequence number of the command
+  fr_t return_value = 0;      ///< The return register after the command
+  std::vector<fr_t> results;  ///< The result registers after the command
+} CompletionRecord;
+
+/**
+ * \class CommandRing
+ * \brief A ring of commands in host memory, fetched by the FPGA itself.
+ *
+ * Starting a UserCore through registers takes an MMIO write for every
+ * buffer address and argument, plus the reset and start. On platforms
+ * where the FPGA accesses host memory, such as SNAP, commands can instead
+ * be appended to a ring in locked host memory, after which the FPGA is
+ * notified of any number of new commands with a single write to the
+ * doorbell register.
+ *
+ * Every slot of the ring is a number of 64-bit words. The first word
+ * holds the number of register values that follow. For every command, the
+ * FPGA writes these values to the registers starting at UC_REG_BUFFERS of
+ * the register window, i.e. the buffer addresses followed by the
+ * arguments, then resets and starts the UserCore, waits for it to finish
+ * and increments the consumed register.
+ *
+ * Optionally, the FPGA writes a completion record for every command to a
+ * second ring in host memory, with the same number of slots and words per
+ * slot. The first word of a record is the sequence number of the command
+ * plus one, written last, followed by the return register and a number of
+ * result registers. Completion is then detected by polling host memory
+ * instead of reading the consumed register, and results need not be read
+ * over MMIO either. Completion records are part of the same prototype as
+ * the ring, see below.
+ *
+ * The ring registers are at a fixed offset in the register window, which
+ * the hardware and host must agree on. A ring must be driven from one
+ * thread at a time.
+ *
+ * \warning This is an unsupported prototype for the simulator only. No
+ * hardware UserCore controller fetches commands from the ring: the AWS and
+ * SNAP platforms return false from command_ring_supported(), and the only
+ * platform that can run a ring is a SimPlatform with enable_command_ring(),
+ * which models the controller. The register layout above is a proposal for
+ * such a controller, and may change when one is built.
+ */
+class CommandRing {
+ public:
+  /**
+   * \param platform   The platform to run the commands on.
+   * \param reg_offset The offset of the ring registers, relative to the
+   *                   register window.
+   * \param num_slots  The number of slots of the ring.
+   * \param slot_words The number of 64-bit words of every slot.
+   * \param window     The register window of the UserCore.
+   *
+   * Throws if the platform does not support command rings.
+   */
+  CommandRing(std::shared_ptr<FPGAPlatform> platform,
+              uint64_t reg_offset,
+              size_t num_slots = RING_DEFAULT_SLOTS,
+              size_t slot_words = RING_DEFAULT_SLOT_WORDS,
+              uint64_t window = 0);
+
+  ~CommandRing();
+
+  /**
+   * \brief Returns true if the ring could be allocated and configured.
+   */
+  bool good();
+
+  /**
+   * \brief Let the FPGA write a completion record for every command.
+   *
+   * Must be called before the first command is pushed. Throws if the
+   * platform does not support command rings.
+   *
+   * Like the ring itself, this is a simulator-only prototype: no hardware
+   * controller writes completion records yet.
+   *
+   * \param result_offset The first register to include in the records,
+   *                      relative to the register window.
+   * \param num_results   The number of registers to include.
+   */
+  int enable_completions(uint64_t result_offset = 0, size_t num_results = 0);
+
+  /**
+   * \brief Append a command to the ring, without notifying the FPGA.
+   *
+   * Waits for a slot if the ring is full. Throws if the buffers and
+   * arguments do not fit in a slot.
+   *
+   * \param buffers   Staged buffers, e.g. from stage_recordbatch().
+   * \param arguments The arguments of the UserCore.
+   * \return the sequence number of the command
+   */
+  uint64_t push(const std::vector<BufConfig> &buffers, const std::vector<fr_t> &arguments);
+
+  /**
+   * \brief Notify the FPGA of all commands pushed so far, with a single
+   * write to the doorbell register.
+   */
+  int submit();
+
+  /**
+   * \brief Return the number of completed commands.
+   */
+  uint64_t completed();
+
+  /**
+   * \brief Wait until the command with some sequence number completed.
+   */
+  uc_stat wait(uint64_t sequence);
+
+  /**
+   * \brief Wait until all submitted commands completed.
+   */
+  uc_stat wait_all();
+
+  /**
+   * \brief Return the completion record of a completed command.
+   *
+   * Records are reused by later commands, so this must be called before
+   * the next num_slots commands after it are pushed. Throws if completion
+   * records are not enabled, or if the record is not available.
+   */
+  CompletionRecord record(uint64_t sequence);
+
+ private:
+  std::shared_ptr<FPGAPlatform> _platform;
+
+  /// The absolute offset of the ring registers
+  uint64_t reg_offset;
+
+  size_t num_slots;
+  size_t slot_words;
+
+  /// The ring memory, locked such that the FPGA can always read it, on the node of the FPGA
+  DmaMemoryPool pool;
+  fr_t *ring = nullptr;
+
+  /// The completion records, if enabled
+  fr_t *records = nullptr;
+  size_t num_results = 0;
+
+  /// Number of commands pushed, submitted and known to be completed
+  uint64_t pushed = 0;
+  uint64_t submitted = 0;
+  uint64_t _completed = 0;
+
+  Poller poller;
+
+  bool error = false;
+
+  /// Update the number of completed commands; returns false if it could not be obtained
+  bool update_completed();
+
+  /// Return the number of bytes of the ring or of the completion records
+  size_t ring_bytes();
+};
+
+}
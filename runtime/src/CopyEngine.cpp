@@ -0,0 +1,225 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+#include "logging.h"
+#include "CopyEngine.h"
+
+namespace fletcher {
+
+static Histogram &write_time = Metrics::global().histogram("fletcher_copy_duration_nanoseconds",
+                                                           "Duration of transfers between host and device.",
+                                                           "direction=\"to_device\"");
+static Histogram &read_time = Metrics::global().histogram("fletcher_copy_duration_nanoseconds",
+                                                          "Duration of transfers between host and device.",
+                                                          "direction=\"from_device\"");
+
+CopyEngine::CopyEngine(const std::vector<std::string> &paths, size_t split_threshold, int numa_node)
+    : split_threshold(split_threshold), numa_node(numa_node) {
+  for (auto const &path : paths) {
+    std::unique_ptr<Queue> queue(new Queue);
+    queue->path = path;
+
+    std::string labels = "queue=\"" + std::to_string(this->queues.size()) + "\"";
+    queue->bytes_written = &Metrics::global().counter("fletcher_copy_bytes_total",
+                                                      "Number of bytes transferred per queue.",
+                                                      labels + ",direction=\"to_device\"");
+    queue->bytes_read = &Metrics::global().counter("fletcher_copy_bytes_total",
+                                                   "Number of bytes transferred per queue.",
+                                                   labels + ",direction=\"from_device\"");
+
+    LOGD("[CopyEngine] Attempting to open queue file " << path);
+    queue->fd = open(path.c_str(), O_RDWR);
+
+    if (queue->fd < 0) {
+      LOGE("[CopyEngine] Could not open queue file " << path << ". Entering error state.");
+      this->error = true;
+    }
+
+    this->queues.push_back(std::move(queue));
+  }
+
+  if (this->queues.empty()) {
+    LOGE("[CopyEngine] No queues. Entering error state.");
+    this->error = true;
+  }
+
+  if (!this->error) {
+    for (auto &queue : this->queues) {
+      queue->worker = std::thread(&CopyEngine::work, this, queue.get());
+    }
+  }
+}
+
+CopyEngine::~CopyEngine() {
+  this->stopping = true;
+
+  for (auto &queue : this->queues) {
+    {
+      std::lock_guard<std::mutex> guard(queue->lock);
+      queue->cv.notify_all();
+    }
+    if (queue->worker.joinable()) {
+      queue->worker.join();
+    }
+    if (queue->fd >= 0) {
+      close(queue->fd);
+    }
+  }
+}
+
+bool CopyEngine::good() {
+  return !this->error;
+}
+
+size_t CopyEngine::write(const uint8_t *source, uint64_t offset, size_t bytes) {
+  return transfer(true, const_cast<uint8_t *>(source), offset, bytes);
+}
+
+size_t CopyEngine::read(uint8_t *dest, uint64_t offset, size_t bytes) {
+  return transfer(false, dest, offset, bytes);
+}
+
+void CopyEngine::set_split_threshold(size_t split_threshold) {
+  this->split_threshold.store(split_threshold);
+}
+
+size_t CopyEngine::num_queues() {
+  return this->queues.size();
+}
+
+size_t CopyEngine::transfer(bool to_device, uint8_t *host, uint64_t offset, size_t bytes) {
+  if (this->error) {
+    throw std::runtime_error("Copy engine is in error state.");
+  }
+
+  if (bytes == 0) {
+    return 0;
+  }
+
+  // Only use more queues if the data to copy is larger than the threshold
+  size_t nq = this->queues.size();
+  if (bytes < this->split_threshold.load()) {
+    nq = 1;
+  }
+
+  size_t qbytes = bytes / nq;
+
+  ScopedTimer timer(to_device ? write_time : read_time);
+
+  Completion completion;
+  completion.remaining = nq;
+
+  for (size_t q = 0; q < nq; q++) {
+    Task task;
+    task.to_device = to_device;
+    task.host = host + q * qbytes;
+    task.offset = offset + q * qbytes;
+    task.bytes = (q == nq - 1) ? bytes - q * qbytes : qbytes;
+    task.completion = &completion;
+
+    LOGD("[CopyEngine] " << (to_device ? "Write " : "Read ") << std::dec << task.bytes << " bytes, host: "
+                         << STRHEX64 << (uint64_t) task.host << ", device: " << STRHEX64 << task.offset
+                         << " over queue " << std::dec << q);
+
+    Queue &queue = *this->queues[q];
+    {
+      std::lock_guard<std::mutex> guard(queue.lock);
+      queue.tasks.push_back(task);
+    }
+    queue.cv.notify_one();
+  }
+
+  // Wait for all parts to complete
+  std::unique_lock<std::mutex> lock(completion.lock);
+  completion.cv.wait(lock, [&completion] { return completion.remaining == 0; });
+
+  if (completion.failed) {
+    LOGE("[CopyEngine] " << (to_device ? "Write to" : "Read from") << " device failed.");
+    throw std::runtime_error(to_device ? "Copy to device failed." : "Copy from device failed.");
+  }
+
+  return completion.bytes;
+}
+
+void CopyEngine::work(Queue *queue) {
+  numa_pin_thread(this->numa_node);
+
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(queue->lock);
+      queue->cv.wait(lock, [this, queue] { return this->stopping || !queue->tasks.empty(); });
+      if (queue->tasks.empty()) {
+        return;
+      }
+      task = queue->tasks.front();
+      queue->tasks.pop_front();
+    }
+
+    ssize_t rc = execute(queue->fd, task);
+
+    Completion *completion = task.completion;
+    std::lock_guard<std::mutex> guard(completion->lock);
+    if (rc < 0) {
+      LOGE("[CopyEngine] Transfer failed on queue " << queue->path << ". RC=" << rc);
+      completion->failed = true;
+    } else {
+      completion->bytes += (size_t) rc;
+      (task.to_device ? queue->bytes_written : queue->bytes_read)->add((uint64_t) rc);
+    }
+    completion->remaining--;
+    if (completion->remaining == 0) {
+      completion->cv.notify_all();
+    }
+  }
+}
+
+ssize_t CopyEngine::execute(int fd, const Task &task) {
+  size_t done = 0;
+
+  while (done < task.bytes) {
+    if (done != 0) {
+      LOGD("[CopyEngine] Partial transfer, attempting to finish. " << done << " out of " << task.bytes << ", "
+                                                                   << task.bytes - done << " remaining.");
+    }
+
+    ssize_t rc;
+    if (task.to_device) {
+      rc = pwrite(fd, task.host + done, task.bytes - done, (off_t) (task.offset + done));
+    } else {
+      rc = pread(fd, task.host + done, task.bytes - done, (off_t) (task.offset + done));
+    }
+
+    // If rc is negative there is something else going wrong, abort.
+    // A transfer of nothing would never finish either.
+    if (rc <= 0) {
+      return -1;
+    }
+    done += (size_t) rc;
+  }
+
+  // Make sure all bytes arrived at the device
+  if (task.to_device && (fsync(fd) != 0)) {
+    return -1;
+  }
+
+  return (ssize_t) done;
+}
+
+}
@@ -0,0 +1,145 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "Metrics.h"
+#include "Numa.h"
+
+#define COPY_ENGINE_DEFAULT_THRESHOLD (1024*1024*1) // 1 MiB
+
+namespace fletcher {
+
+/**
+ * \class CopyEngine
+ * \brief Multi-queue DMA copy engine for file-based DMA interfaces.
+ *
+ * Every queue is a file (e.g. an EDMA queue device) that is opened once and
+ * stays open for the lifetime of the engine. Every queue is driven by its
+ * own worker thread. Transfers larger than the split threshold are divided
+ * over all queues, which then transfer their parts at the same time.
+ *
+ * The worker threads can be pinned to the NUMA node of the device, such
+ * that the copies are driven from the socket the device is attached to.
+ *
+ * Because the queues are plain files accessed with pread/pwrite, the engine
+ * can be tested against regular files. All functions are thread-safe.
+ */
+class CopyEngine {
+ public:
+  /**
+   * \param paths           The file of every queue.
+   * \param split_threshold Transfers of fewer bytes use a single queue.
+   * \param numa_node       The NUMA node to run the worker threads on.
+   */
+  explicit CopyEngine(const std::vector<std::string> &paths,
+                      size_t split_threshold = COPY_ENGINE_DEFAULT_THRESHOLD,
+                      int numa_node = NUMA_NODE_NONE);
+
+  ~CopyEngine();
+
+  /**
+   * \brief Returns true if all queues could be opened.
+   */
+  bool good();
+
+  /**
+   * \brief Copy bytes from host memory to the device at some offset.
+   *
+   * Blocks until the copy is complete. Throws on failure.
+   * \return the number of bytes copied
+   */
+  size_t write(const uint8_t *source, uint64_t offset, size_t bytes);
+
+  /**
+   * \brief Copy bytes from the device at some offset to host memory.
+   *
+   * Blocks until the copy is complete. Throws on failure.
+   * \return the number of bytes copied
+   */
+  size_t read(uint8_t *dest, uint64_t offset, size_t bytes);
+
+  /**
+   * \brief Set the minimum number of bytes for which a transfer is split
+   * over all queues.
+   */
+  void set_split_threshold(size_t split_threshold);
+
+  /**
+   * \brief Return the number of queues.
+   */
+  size_t num_queues();
+
+ private:
+  /// Completion state shared by all parts of a transfer
+  typedef struct _Completion {
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t remaining;
+    size_t bytes = 0;
+    bool failed = false;
+  } Completion;
+
+  /// A part of a transfer assigned to a single queue
+  typedef struct _Task {
+    bool to_device;
+    uint8_t *host;
+    uint64_t offset;
+    size_t bytes;
+    Completion *completion;
+  } Task;
+
+  typedef struct _Queue {
+    std::string path;
+    int fd = -1;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<Task> tasks;
+    Counter *bytes_written;
+    Counter *bytes_read;
+  } Queue;
+
+  std::vector<std::unique_ptr<Queue>> queues;
+
+  /// May be changed by set_split_threshold while other threads transfer
+  std::atomic<size_t> split_threshold;
+
+  int numa_node;
+
+  bool error = false;
+  std::atomic<bool> stopping{false};
+
+  /// Split a transfer over the queues and wait for it
+  size_t transfer(bool to_device, uint8_t *host, uint64_t offset, size_t bytes);
+
+  void work(Queue *queue);
+
+  static ssize_t execute(int fd, const Task &task);
+};
+
+}
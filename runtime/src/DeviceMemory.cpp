@@ -0,0 +1,148 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdexcept>
+
+#include "logging.h"
+#include "DeviceMemory.h"
+
+namespace fletcher {
+
+static inline bool is_pow2(uint64_t x) {
+  return (x != 0) && ((x & (x - 1)) == 0);
+}
+
+DeviceMemory::DeviceMemory(fa_t base, uint64_t size, uint64_t min_block)
+    : base(base), _size(size), min_block(min_block) {
+  if (!is_pow2(min_block)) {
+    throw std::runtime_error("Minimum device memory block size must be a power of two.");
+  }
+
+  // Carve the range into the largest blocks that are aligned to their own size.
+  uint64_t offset = 0;
+  uint64_t end = size - (size % min_block);
+  while (offset < end) {
+    unsigned int order = 0;
+    while ((block_size(order + 1) <= end - offset) && (offset % block_size(order + 1) == 0)) {
+      order++;
+    }
+    if (this->free_blocks.size() <= order) {
+      this->free_blocks.resize(order + 1);
+    }
+    this->free_blocks[order].insert(offset);
+    this->top_blocks[offset] = order;
+    offset += block_size(order);
+  }
+}
+
+int DeviceMemory::allocate(uint64_t size, uint64_t alignment, fa_t *address) {
+  if (!is_pow2(alignment)) {
+    throw std::runtime_error("Device memory alignment must be a power of two.");
+  }
+
+  // Determine the smallest order that satisfies both the size and the alignment.
+  unsigned int order = 0;
+  while ((block_size(order) < size) || (block_size(order) < alignment)) {
+    order++;
+  }
+
+  std::lock_guard<std::mutex> guard(this->lock);
+
+  // Find the smallest free block that is large enough.
+  unsigned int from = order;
+  while ((from < this->free_blocks.size()) && this->free_blocks[from].empty()) {
+    from++;
+  }
+
+  if (from >= this->free_blocks.size()) {
+    LOGD("[DeviceMemory] Cannot allocate " << size << " bytes. Allocated: " << this->_allocated << " of "
+                                           << this->_size);
+    return ERROR;
+  }
+
+  uint64_t offset = *this->free_blocks[from].begin();
+  this->free_blocks[from].erase(this->free_blocks[from].begin());
+
+  // Split the block until it has the right order, freeing the upper halves.
+  while (from > order) {
+    from--;
+    this->free_blocks[from].insert(offset + block_size(from));
+  }
+
+  this->allocations[offset] = order;
+  this->_allocated += block_size(order);
+
+  *address = this->base + offset;
+
+  return OK;
+}
+
+int DeviceMemory::free(fa_t address) {
+  std::lock_guard<std::mutex> guard(this->lock);
+
+  uint64_t offset = address - this->base;
+  auto alloc = this->allocations.find(offset);
+
+  if (alloc == this->allocations.end()) {
+    LOGE("[DeviceMemory] Attempt to free unallocated address " << STRHEX64 << address);
+    return ERROR;
+  }
+
+  unsigned int order = alloc->second;
+  this->allocations.erase(alloc);
+  this->_allocated -= block_size(order);
+
+  // Merge with the buddy as long as it is free and within the same top-level block.
+  unsigned int max_order = top_order(offset);
+  while (order < max_order) {
+    uint64_t buddy = offset ^ block_size(order);
+    auto it = this->free_blocks[order].find(buddy);
+    if (it == this->free_blocks[order].end()) {
+      break;
+    }
+    this->free_blocks[order].erase(it);
+    offset &= ~block_size(order);
+    order++;
+  }
+
+  this->free_blocks[order].insert(offset);
+
+  return OK;
+}
+
+uint64_t DeviceMemory::allocation_size(fa_t address) {
+  std::lock_guard<std::mutex> guard(this->lock);
+  auto alloc = this->allocations.find(address - this->base);
+  if (alloc == this->allocations.end()) {
+    return 0;
+  }
+  return block_size(alloc->second);
+}
+
+uint64_t DeviceMemory::allocated() {
+  std::lock_guard<std::mutex> guard(this->lock);
+  return this->_allocated;
+}
+
+uint64_t DeviceMemory::size() {
+  return this->_size;
+}
+
+unsigned int DeviceMemory::top_order(uint64_t offset) {
+  auto top = this->top_blocks.upper_bound(offset);
+  --top;
+  return top->second;
+}
+
+}
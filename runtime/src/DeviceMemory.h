@@ -0,0 +1,105 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+namespace fletcher {
+
+/**
+ * \class DeviceMemory
+ * \brief Buddy allocator for on-board device memory.
+ *
+ * Manages a range of device addresses in blocks of min_block << order bytes.
+ * Every block is aligned to its own size relative to the base address, so
+ * an allocation is aligned to any power of two up to its rounded-up size.
+ *
+ * The allocator only keeps track of addresses; it never touches the device
+ * memory itself. All functions are thread-safe.
+ */
+class DeviceMemory {
+ public:
+  /**
+   * \param base      The first device address to manage.
+   * \param size      The number of bytes to manage.
+   * \param min_block The smallest block size. Must be a power of two.
+   */
+  DeviceMemory(fa_t base, uint64_t size, uint64_t min_block = 4096);
+
+  /**
+   * \brief Allocate a block of device memory.
+   *
+   * \param size      The number of bytes to allocate.
+   * \param alignment The alignment of the address. Must be a power of two.
+   * \param address   The address of the allocated block.
+   * \return OK on success, ERROR if no block of sufficient size is free.
+   */
+  int allocate(uint64_t size, uint64_t alignment, fa_t *address);
+
+  /**
+   * \brief Free a block that was previously allocated.
+   * \return OK on success, ERROR if address was not allocated.
+   */
+  int free(fa_t address);
+
+  /**
+   * \brief Return the size of the block allocated at an address, or 0 if
+   * nothing was allocated there.
+   */
+  uint64_t allocation_size(fa_t address);
+
+  /**
+   * \brief Return the number of bytes currently allocated, including the
+   * rounding to block sizes.
+   */
+  uint64_t allocated();
+
+  /**
+   * \brief Return the number of bytes managed by this allocator.
+   */
+  uint64_t size();
+
+ private:
+  fa_t base;
+  uint64_t _size;
+  uint64_t min_block;
+
+  std::mutex lock;
+
+  uint64_t _allocated = 0;
+
+  /// Free blocks (offsets relative to base) per order
+  std::vector<std::set<uint64_t>> free_blocks;
+
+  /// Allocated blocks (offsets relative to base) and their order
+  std::unordered_map<uint64_t, unsigned int> allocations;
+
+  /// The largest blocks the managed range was carved into, and their order
+  std::map<uint64_t, unsigned int> top_blocks;
+
+  uint64_t block_size(unsigned int order) { return this->min_block << order; }
+
+  /// Return the order of the top-level block containing an offset
+  unsigned int top_order(uint64_t offset);
+};
+
+}
@@ -0,0 +1,253 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "logging.h"
+#include "DevicePool.h"
+#include "Numa.h"
+
+namespace fletcher {
+
+typedef std::chrono::steady_clock pool_clock;
+
+static inline double seconds_since(pool_clock::time_point start) {
+  return std::chrono::duration<double>(pool_clock::now() - start).count();
+}
+
+DevicePool::DevicePool(std::vector<std::shared_ptr<FPGAPlatform>> platforms, const usercore_factory &factory)
+    : platforms(std::move(platforms)) {
+  if (this->platforms.empty()) {
+    throw std::runtime_error("A DevicePool needs at least one platform.");
+  }
+
+  for (const auto &platform : this->platforms) {
+    this->usercores.push_back(factory(platform));
+  }
+
+  this->_stats.resize(this->platforms.size());
+  this->queues.resize(this->platforms.size());
+}
+
+uint64_t DevicePool::prepare_table(const std::shared_ptr<arrow::Table> &table) {
+  std::vector<std::future<uint64_t>> prepared;
+
+  for (const auto &platform : this->platforms) {
+    prepared.push_back(std::async(std::launch::async, [platform, &table]() {
+      numa_pin_thread(platform->numa_node());
+      return platform->prepare_table(table);
+    }));
+  }
+
+  // get() rethrows any exception that occurred while preparing
+  uint64_t bytes = 0;
+  for (auto &p : prepared) {
+    bytes += p.get();
+  }
+
+  LOGD("[DevicePool] Prepared " << bytes << " bytes on " << this->platforms.size() << " devices.");
+
+  return bytes;
+}
+
+uc_stat DevicePool::run(int64_t rows_per_range,
+                        const arguments_t &arguments,
+                        const done_t &done,
+                        unsigned int poll_interval_usec) {
+  if (rows_per_range <= 0) {
+    throw std::runtime_error("Rows per range must be positive.");
+  }
+
+  size_t num_devices = this->platforms.size();
+  size_t num_chunks = this->platforms[0]->num_chunks();
+
+  for (const auto &platform : this->platforms) {
+    if (platform->num_chunks() != num_chunks) {
+      LOGE("[DevicePool] Not all devices have prepared the same number of chunks.");
+      return FAILURE;
+    }
+  }
+
+  // Split all chunks into ranges, in order
+  std::vector<RowRange> ranges;
+  for (size_t c = 0; c < num_chunks; c++) {
+    int64_t length = this->platforms[0]->chunk_config(c).length;
+    for (int64_t first = 0; first < length; first += rows_per_range) {
+      ranges.push_back({c, first, std::min(first + rows_per_range, length)});
+    }
+  }
+
+  // Give every device an even, contiguous share to start with
+  for (size_t d = 0; d < num_devices; d++) {
+    this->queues[d].assign(ranges.begin() + d * ranges.size() / num_devices,
+                           ranges.begin() + (d + 1) * ranges.size() / num_devices);
+    this->_stats[d] = DeviceStats();
+  }
+
+  this->busy = 0;
+  this->done_error = nullptr;
+
+  LOGD("[DevicePool] Running " << ranges.size() << " ranges on " << num_devices << " devices.");
+
+  std::vector<std::thread> workers;
+  for (size_t d = 0; d < num_devices; d++) {
+    workers.emplace_back(&DevicePool::work, this, d, std::cref(arguments), std::cref(done), poll_interval_usec);
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+
+  size_t left = 0;
+  for (auto &q : this->queues) {
+    left += q.size();
+    q.clear();
+  }
+
+  if (this->done_error) {
+    std::rethrow_exception(this->done_error);
+  }
+
+  if (left > 0) {
+    LOGE("[DevicePool] " << left << " ranges were not processed.");
+    return FAILURE;
+  }
+
+  return SUCCESS;
+}
+
+bool DevicePool::next_range(size_t device, RowRange &range) {
+  std::unique_lock<std::mutex> lock(this->queues_lock);
+
+  while (true) {
+    auto &own = this->queues[device];
+    if (!own.empty()) {
+      range = own.front();
+      own.pop_front();
+      this->busy++;
+      return true;
+    }
+
+    // Steal from the end of the device with the most work left
+    size_t victim = device;
+    for (size_t d = 0; d < this->queues.size(); d++) {
+      if (this->queues[d].size() > (victim == device ? 0 : this->queues[victim].size())) {
+        victim = d;
+      }
+    }
+
+    if (victim != device) {
+      range = this->queues[victim].back();
+      this->queues[victim].pop_back();
+      this->_stats[device].stolen++;
+      this->busy++;
+      return true;
+    }
+
+    // A device that is still busy may fail and push its range back
+    if (this->busy == 0) {
+      return false;
+    }
+    this->queues_cv.wait(lock);
+  }
+}
+
+void DevicePool::finish_range(size_t device, const RowRange &range, bool failed) {
+  std::lock_guard<std::mutex> guard(this->queues_lock);
+  if (failed) {
+    this->queues[device].push_front(range);
+  }
+  this->busy--;
+  this->queues_cv.notify_all();
+}
+
+void DevicePool::work(size_t device,
+                      const arguments_t &arguments,
+                      const done_t &done,
+                      unsigned int poll_interval_usec) {
+  auto &platform = this->platforms[device];
+  auto &usercore = this->usercores[device];
+  auto &stats = this->_stats[device];
+
+  // Poll the device from its own socket
+  numa_pin_thread(platform->numa_node());
+
+  RowRange range;
+  while (next_range(device, range)) {
+    auto start = pool_clock::now();
+    uc_stat stat = FAILURE;
+
+    try {
+      usercore->reset();
+      if (platform->select_chunk(range.chunk, usercore->window()) == OK
+          && usercore->set_arguments(arguments(device, range)) == SUCCESS) {
+        usercore->start();
+        stat = poll_interval_usec == 0 ? usercore->wait_for_finish() : usercore->wait_for_finish(poll_interval_usec);
+      }
+    } catch (const std::exception &e) {
+      LOGE("[DevicePool] Device " << device << ": " << e.what());
+    }
+
+    stats.busy += seconds_since(start);
+
+    if (stat != SUCCESS) {
+      LOGE("[DevicePool] Device " << device << " failed on rows " << range.first << " to " << range.last
+                                  << " of chunk " << range.chunk << ". Leaving its ranges to other devices.");
+      stats.failed = true;
+      finish_range(device, range, true);
+      return;
+    }
+
+    if (done) {
+      std::lock_guard<std::mutex> guard(this->done_lock);
+      try {
+        done(device, *usercore, range);
+      } catch (...) {
+        LOGE("[DevicePool] Device " << device << " failed to finish rows " << range.first << " to " << range.last
+                                    << " of chunk " << range.chunk << ". Leaving its ranges to other devices.");
+        if (!this->done_error) {
+          this->done_error = std::current_exception();
+        }
+        stats.failed = true;
+        finish_range(device, range, true);
+        return;
+      }
+    }
+
+    finish_range(device, range, false);
+
+    stats.ranges++;
+    stats.rows += range.last - range.first;
+  }
+
+  LOGD("[DevicePool] Device " << device << " processed " << stats.ranges << " ranges (" << stats.stolen
+                              << " stolen) in " << stats.busy << " s.");
+}
+
+size_t DevicePool::num_devices() {
+  return this->platforms.size();
+}
+
+std::shared_ptr<UserCore> DevicePool::usercore(size_t device) {
+  return this->usercores.at(device);
+}
+
+const std::vector<DeviceStats> &DevicePool::stats() {
+  return this->_stats;
+}
+
+}
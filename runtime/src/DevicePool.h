@@ -0,0 +1,151 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "UserCore.h"
+
+namespace fletcher {
+
+/**
+ * A range of rows [first, last) within a prepared chunk.
+ */
+typedef struct _RowRange {
+  size_t chunk;
+  int64_t first;
+  int64_t last;
+} RowRange;
+
+/**
+ * Work done by a single device during a run. Times are in seconds.
+ */
+typedef struct _DeviceStats {
+  uint64_t ranges = 0;    // Number of ranges processed
+  uint64_t rows = 0;      // Number of rows processed
+  uint64_t stolen = 0;    // Number of ranges taken from other devices
+  double busy = 0.0;      // Time spent processing ranges
+  bool failed = false;    // Whether the device failed during the run
+} DeviceStats;
+
+/**
+ * \class DevicePool
+ * \brief Runs a UserCore on several FPGA platforms at once.
+ *
+ * Every platform gets its own UserCore, created with a factory, and
+ * prepares the complete table. A run splits the rows of every chunk into
+ * ranges that are initially divided evenly over the devices, in order.
+ * A device that runs out of ranges steals from the end of the device with
+ * the most ranges left, so faster devices process more of the table.
+ * When a device fails, its remaining ranges are taken over by the others.
+ */
+class DevicePool {
+ public:
+  /// Function creating the UserCore for a platform
+  typedef std::function<std::shared_ptr<UserCore>(std::shared_ptr<FPGAPlatform>)> usercore_factory;
+  /// Function returning the UserCore arguments of a range on some device
+  typedef std::function<std::vector<fr_t>(size_t, const RowRange &)> arguments_t;
+  /// Function called after a device finished a range, e.g. to merge its results
+  typedef std::function<void(size_t, UserCore &, const RowRange &)> done_t;
+
+  /**
+   * \param platforms The platforms to run on. Each must be a separate device.
+   * \param factory   Function creating the UserCore for each platform.
+   */
+  DevicePool(std::vector<std::shared_ptr<FPGAPlatform>> platforms, const usercore_factory &factory);
+
+  /**
+   * \brief Prepare a table on all platforms, in parallel.
+   * \return the total number of bytes prepared
+   */
+  uint64_t prepare_table(const std::shared_ptr<arrow::Table> &table);
+
+  /**
+   * \brief Run the UserCores on all rows of the prepared table.
+   *
+   * \param rows_per_range The number of rows per range.
+   * \param arguments      Function returning the UserCore arguments of a
+   *                       range. Called on the thread of the device.
+   * \param done           Optional function called after each range. Calls
+   *                       are serialized, so it may merge results into
+   *                       shared state without further locking.
+   * \param poll_interval_usec The interval to poll the status, or 0 to
+   *                       poll adaptively.
+   * \return SUCCESS if all ranges were processed, FAILURE otherwise
+   *
+   * If done throws, the device is treated as failed and its range is left
+   * to the other devices. The first such exception is rethrown once all
+   * devices have finished.
+   */
+  uc_stat run(int64_t rows_per_range,
+              const arguments_t &arguments,
+              const done_t &done = nullptr,
+              unsigned int poll_interval_usec = 0);
+
+  /**
+   * \brief Return the number of devices in this pool.
+   */
+  size_t num_devices();
+
+  /**
+   * \brief Return the UserCore of a device.
+   */
+  std::shared_ptr<UserCore> usercore(size_t device);
+
+  /**
+   * \brief Return the work done by every device during the last run.
+   */
+  const std::vector<DeviceStats> &stats();
+
+ private:
+  std::vector<std::shared_ptr<FPGAPlatform>> platforms;
+  std::vector<std::shared_ptr<UserCore>> usercores;
+  std::vector<DeviceStats> _stats;
+
+  /// Ranges left per device
+  std::vector<std::deque<RowRange>> queues;
+  std::mutex queues_lock;
+  std::condition_variable queues_cv;
+  std::mutex done_lock;
+  /// The first exception thrown by the done function of a run, guarded by done_lock
+  std::exception_ptr done_error;
+
+  /// Number of ranges taken but not yet finished
+  size_t busy = 0;
+
+  /**
+   * Take the next range for a device, stealing if needed. Waits while other
+   * devices are busy, as they may still fail. Returns false if none are left.
+   */
+  bool next_range(size_t device, RowRange &range);
+
+  /// Mark a range taken by next_range() as finished, or push it back if it failed
+  void finish_range(size_t device, const RowRange &range, bool failed);
+
+  /// Process ranges on a device until none are left or the device fails
+  void work(size_t device, const arguments_t &arguments, const done_t &done, unsigned int poll_interval_usec);
+};
+
+}
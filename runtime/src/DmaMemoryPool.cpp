@@ -0,0 +1,307 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "logging.h"
+#include "DmaMemoryPool.h"
+
+namespace fletcher {
+
+namespace {
+
+/// Zero-size allocations all point here
+alignas(4096) uint8_t zero_size_area[1];
+
+/// All live DmaMemoryPool allocations, by start address, and their usable length. Never destroyed, as buffers may
+/// be freed during static destruction.
+std::map<uintptr_t, uint64_t> &registry() {
+  static auto *allocations = new std::map<uintptr_t, uint64_t>;
+  return *allocations;
+}
+
+std::mutex &registry_lock() {
+  static auto *lock = new std::mutex;
+  return *lock;
+}
+
+uint64_t round_up(uint64_t size, uint64_t multiple) {
+  return ((size + multiple - 1) / multiple) * multiple;
+}
+
+uint64_t page_size() {
+  static const auto size = (uint64_t) sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+/// Return the usable length of an allocation starting at address, or 0
+uint64_t mapped_length(const uint8_t *address) {
+  std::lock_guard<std::mutex> guard(registry_lock());
+  auto it = registry().find(reinterpret_cast<uintptr_t>(address));
+  return it == registry().end() ? 0 : it->second;
+}
+
+}
+
+DmaMemoryPool::DmaMemoryPool(bool huge_pages, bool lock, int node)
+    : huge_pages(huge_pages), lock(lock), node(node) {}
+
+DmaMemoryPool::~DmaMemoryPool() {
+  for (auto const &slab : this->slabs) {
+    if (slab.second.used_pages != 0) {
+      LOGE("[DmaMemoryPool] Pool destroyed while " << slab.second.used_pages << " pages of the slab at " << STRHEX64
+                                                   << (uint64_t) slab.first << " are in use.");
+    }
+    munmap(reinterpret_cast<void *>(slab.first), slab.second.length);
+  }
+}
+
+uint8_t *DmaMemoryPool::map(int64_t size, uint64_t *mapped) {
+  void *address = MAP_FAILED;
+  uint64_t length = 0;
+
+  if (huge_pages) {
+    length = round_up((uint64_t) size, DMA_HUGE_PAGE_SIZE);
+    address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (address == MAP_FAILED) {
+      LOGD("[DmaMemoryPool] No huge pages available for " << size << " bytes, using regular pages.");
+    }
+  }
+
+  if (address == MAP_FAILED) {
+    length = round_up((uint64_t) size, page_size());
+    address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (address == MAP_FAILED) {
+      return nullptr;
+    }
+  }
+
+  // Nothing is faulted in yet, so all pages are allocated on the node. Without it, they would end up on the node
+  // of whichever thread touches them first.
+  numa_bind(address, length, node);
+
+  if (lock && (mlock(address, length) != 0)) {
+    // The memory is still usable, but may be paged out
+    LOGE("[DmaMemoryPool] Could not lock " << length << " bytes: " << strerror(errno));
+  }
+
+  *mapped = length;
+  return reinterpret_cast<uint8_t *>(address);
+}
+
+uint8_t *DmaMemoryPool::carve(uint64_t length) {
+  size_t pages = length / page_size();
+
+  std::lock_guard<std::mutex> guard(this->slabs_lock);
+
+  // First fit in the existing slabs
+  for (auto &slab : this->slabs) {
+    auto &used = slab.second.used;
+    if (used.size() - slab.second.used_pages < pages) {
+      continue;
+    }
+    size_t run = 0;
+    for (size_t p = 0; p < used.size(); p++) {
+      run = used[p] ? 0 : run + 1;
+      if (run == pages) {
+        size_t first = p + 1 - pages;
+        std::fill(used.begin() + first, used.begin() + p + 1, true);
+        slab.second.used_pages += pages;
+        return reinterpret_cast<uint8_t *>(slab.first + first * page_size());
+      }
+    }
+  }
+
+  uint64_t mapped;
+  uint8_t *base = map(DMA_SLAB_SIZE, &mapped);
+  if (base == nullptr) {
+    return nullptr;
+  }
+
+  LOGD("[DmaMemoryPool] New slab of " << mapped << " bytes at " << STRHEX64 << (uint64_t) base);
+
+  Slab slab;
+  slab.length = mapped;
+  slab.used.resize(mapped / page_size(), false);
+  std::fill(slab.used.begin(), slab.used.begin() + pages, true);
+  slab.used_pages = pages;
+  this->slabs[reinterpret_cast<uintptr_t>(base)] = std::move(slab);
+
+  return base;
+}
+
+bool DmaMemoryPool::release(uint8_t *buffer, uint64_t length) {
+  auto start = reinterpret_cast<uintptr_t>(buffer);
+
+  std::lock_guard<std::mutex> guard(this->slabs_lock);
+  auto it = this->slabs.upper_bound(start);
+  if (it == this->slabs.begin()) {
+    return false;
+  }
+  --it;
+  if (start >= it->first + it->second.length) {
+    return false;
+  }
+
+  size_t first = (start - it->first) / page_size();
+  size_t pages = length / page_size();
+  std::fill(it->second.used.begin() + first, it->second.used.begin() + first + pages, false);
+  it->second.used_pages -= pages;
+
+  // Keep a single empty slab around, such that allocating and freeing a small buffer repeatedly does not map it
+  // every time
+  if ((it->second.used_pages == 0) && (this->slabs.size() > 1)) {
+    munmap(reinterpret_cast<void *>(it->first), it->second.length);
+    this->slabs.erase(it);
+  }
+
+  return true;
+}
+
+arrow::Status DmaMemoryPool::Allocate(int64_t size, uint8_t **out) {
+  if (size < 0) {
+    return arrow::Status::Invalid("Negative allocation size.");
+  }
+
+  if (size == 0) {
+    *out = zero_size_area;
+    return arrow::Status::OK();
+  }
+
+  uint64_t length = round_up((uint64_t) size, page_size());
+  if (length <= DMA_SMALL_ALLOCATION) {
+    *out = carve(length);
+  } else {
+    *out = map(size, &length);
+  }
+  if (*out == nullptr) {
+    return arrow::Status::OutOfMemory("Could not map " + std::to_string(size) + " bytes: " + strerror(errno));
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(registry_lock());
+    registry()[reinterpret_cast<uintptr_t>(*out)] = length;
+  }
+
+  int64_t now = allocated += size;
+  int64_t max = max_allocated;
+  while ((now > max) && !max_allocated.compare_exchange_weak(max, now)) {}
+
+  return arrow::Status::OK();
+}
+
+arrow::Status DmaMemoryPool::Reallocate(int64_t old_size, int64_t new_size, uint8_t **ptr) {
+  if (new_size < 0) {
+    return arrow::Status::Invalid("Negative allocation size.");
+  }
+
+  // Grow or shrink in place as long as the mapping is large enough
+  if ((*ptr != zero_size_area) && (new_size > 0) && ((uint64_t) new_size <= mapped_length(*ptr))) {
+    allocated += new_size - old_size;
+    return arrow::Status::OK();
+  }
+
+  uint8_t *out;
+  arrow::Status status = Allocate(new_size, &out);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if ((old_size > 0) && (new_size > 0)) {
+    memcpy(out, *ptr, (size_t) std::min(old_size, new_size));
+  }
+
+  Free(*ptr, old_size);
+  *ptr = out;
+
+  return arrow::Status::OK();
+}
+
+void DmaMemoryPool::Free(uint8_t *buffer, int64_t size) {
+  if (buffer == zero_size_area) {
+    return;
+  }
+
+  uint64_t length;
+  {
+    std::lock_guard<std::mutex> guard(registry_lock());
+    auto it = registry().find(reinterpret_cast<uintptr_t>(buffer));
+    if (it == registry().end()) {
+      LOGE("[DmaMemoryPool] Attempt to free " << STRHEX64 << (uint64_t) buffer << ", which was not allocated.");
+      return;
+    }
+    length = it->second;
+    registry().erase(it);
+  }
+
+  // munmap also unlocks the pages
+  if (!release(buffer, length)) {
+    munmap(buffer, length);
+  }
+  allocated -= size;
+}
+
+int64_t DmaMemoryPool::bytes_allocated() const {
+  return allocated;
+}
+
+int64_t DmaMemoryPool::max_memory() const {
+  return max_allocated;
+}
+
+bool DmaMemoryPool::is_dma_ready(const void *address, int64_t size) {
+  auto start = reinterpret_cast<uintptr_t>(address);
+
+  std::lock_guard<std::mutex> guard(registry_lock());
+  auto it = registry().upper_bound(start);
+  if (it == registry().begin()) {
+    return false;
+  }
+  --it;
+
+  return start + (uint64_t) size <= it->first + it->second;
+}
+
+DmaMemoryPool *dma_memory_pool() {
+  // Never destroyed, as buffers may be freed during static destruction
+  static auto *pool = new DmaMemoryPool;
+  return pool;
+}
+
+DmaMemoryPool *dma_memory_pool(int node) {
+  if (node < 0) {
+    return dma_memory_pool();
+  }
+
+  // Never destroyed, as buffers may be freed during static destruction
+  static auto *lock = new std::mutex;
+  static auto *pools = new std::map<int, std::unique_ptr<DmaMemoryPool>>;
+
+  std::lock_guard<std::mutex> guard(*lock);
+  auto &pool = (*pools)[node];
+  if (!pool) {
+    pool.reset(new DmaMemoryPool(false, false, node));
+  }
+  return pool.get();
+}
+
+}
@@ -0,0 +1,132 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "Numa.h"
+
+/// The size of a huge page used by DmaMemoryPool
+#define DMA_HUGE_PAGE_SIZE (2ul * 1024 * 1024)
+
+/// The size of the mappings that small allocations are carved out of
+#define DMA_SLAB_SIZE DMA_HUGE_PAGE_SIZE
+
+/// Allocations up to this size are carved out of slabs
+#define DMA_SMALL_ALLOCATION (256ul * 1024)
+
+namespace fletcher {
+
+/**
+ * \class DmaMemoryPool
+ * \brief Arrow MemoryPool that allocates memory suitable for DMA.
+ *
+ * Every allocation starts at a page boundary, so buffers built with Arrow
+ * builders from this pool satisfy the alignment of all platforms without
+ * any fixups. Large allocations are mapped separately, while small ones
+ * are carved out of shared slabs of DMA_SLAB_SIZE bytes, such that a small
+ * buffer costs neither a system call nor a huge page of its own.
+ * Optionally, allocations are backed by huge pages, to reduce the number
+ * of address translations the FPGA has to perform, and locked in memory,
+ * such that they are never paged out while the FPGA accesses them.
+ *
+ * All allocations are registered as DMA-ready; use is_dma_ready() to find
+ * out if a buffer was allocated from any DmaMemoryPool.
+ *
+ * On hosts with several sockets, allocations can be placed on the NUMA node
+ * of the FPGA, such that transfers do not cross the socket interconnect.
+ *
+ * Like any Arrow MemoryPool, the pool must outlive all buffers allocated
+ * from it. The pools returned by dma_memory_pool() are never destroyed.
+ */
+class DmaMemoryPool : public arrow::MemoryPool {
+ public:
+  /**
+   * \param huge_pages Back allocations with huge pages. Falls back to
+   *                   regular pages when no huge pages are available.
+   * \param lock       Lock allocations in memory.
+   * \param node       The NUMA node to allocate on, e.g. that of
+   *                   FPGAPlatform::numa_node(), or NUMA_NODE_NONE.
+   */
+  explicit DmaMemoryPool(bool huge_pages = false, bool lock = false, int node = NUMA_NODE_NONE);
+
+  /// Unmaps all slabs; buffers carved out of them must have been freed
+  ~DmaMemoryPool() override;
+
+  arrow::Status Allocate(int64_t size, uint8_t **out) override;
+
+  arrow::Status Reallocate(int64_t old_size, int64_t new_size, uint8_t **ptr) override;
+
+  void Free(uint8_t *buffer, int64_t size) override;
+
+  int64_t bytes_allocated() const override;
+
+  int64_t max_memory() const override;
+
+  /**
+   * \brief Return true if [address, address + size) lies within a single
+   * allocation of a DmaMemoryPool.
+   */
+  static bool is_dma_ready(const void *address, int64_t size = 0);
+
+ private:
+  bool huge_pages;
+  bool lock;
+  int node;
+
+  std::atomic<int64_t> allocated{0};
+  std::atomic<int64_t> max_allocated{0};
+
+  /// A mapping that small allocations are carved out of, in pages
+  typedef struct _Slab {
+    uint64_t length;
+    std::vector<bool> used;
+    size_t used_pages;
+  } Slab;
+
+  /// Protects the slabs
+  std::mutex slabs_lock;
+
+  /// All slabs of this pool, by start address
+  std::map<uintptr_t, Slab> slabs;
+
+  /// Map a region of at least size bytes
+  uint8_t *map(int64_t size, uint64_t *mapped);
+
+  /// Carve length bytes, a multiple of the page size, out of a slab
+  uint8_t *carve(uint64_t length);
+
+  /// Return a carved region to its slab, or return false if it is not part of one
+  bool release(uint8_t *buffer, uint64_t length);
+};
+
+/**
+ * \brief Return a process-wide DmaMemoryPool using regular, unlocked pages.
+ */
+DmaMemoryPool *dma_memory_pool();
+
+/**
+ * \brief Return a process-wide DmaMemoryPool using regular, unlocked pages
+ * on a NUMA node.
+ */
+DmaMemoryPool *dma_memory_pool(int node);
+
+}
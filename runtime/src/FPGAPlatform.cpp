@@ -12,62 +12,460 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <iomanip>
 
 #include "FPGAPlatform.h"
+#include "Metrics.h"
 #include "logging.h"
 
 namespace fletcher {
 
+static Histogram &organize_time = Metrics::global().histogram("fletcher_organize_buffers_nanoseconds",
+                                                              "Time spent organizing buffers for the platform.");
+static Counter &organized_bytes = Metrics::global().counter("fletcher_organized_bytes_total",
+                                                            "Number of bytes organized for the platform.");
+static Counter &readback_bytes = Metrics::global().counter("fletcher_readback_bytes_total",
+                                                           "Number of bytes read back from the device.");
+
 uint64_t FPGAPlatform::prepare_column_chunks(const std::shared_ptr<arrow::Column> &column) {
+  std::vector<std::vector<std::shared_ptr<arrow::ArrayData>>> chunks;
+
+  for (auto const &chunk : column->data()->chunks()) {
+    chunks.push_back({chunk->data()});
+  }
+
+  return prepare_chunks({column->field()}, chunks);
+}
+
+uint64_t FPGAPlatform::prepare_recordbatch(const std::shared_ptr<arrow::RecordBatch> &record_batch) {
+  std::vector<std::shared_ptr<arrow::ArrayData>> chunk;
+
+  for (int f = 0; f < record_batch->num_columns(); f++) {
+    chunk.push_back(record_batch->column_data(f));
+  }
+
+  return prepare_chunks(record_batch->schema()->fields(), {chunk});
+}
+
+uint64_t FPGAPlatform::prepare_table(const std::shared_ptr<arrow::Table> &table) {
+  std::vector<std::vector<std::shared_ptr<arrow::ArrayData>>> chunks;
+
+  for (int f = 0; f < table->num_columns(); f++) {
+    auto column = table->column(f);
+    auto num_chunks = static_cast<size_t>(column->data()->num_chunks());
+
+    // Chunk c of every column is processed in the same UserCore run
+    if (f == 0) {
+      chunks.resize(num_chunks);
+    } else if (num_chunks != chunks.size()) {
+      throw std::runtime_error("Column " + column->name() + " has a different number of chunks than column 0.");
+    }
+
+    for (size_t c = 0; c < num_chunks; c++) {
+      chunks[c].push_back(column->data()->chunk(static_cast<int>(c))->data());
+    }
+  }
+
+  return prepare_chunks(table->schema()->fields(), chunks);
+}
+
+uint64_t FPGAPlatform::prepare_chunks(const std::vector<std::shared_ptr<arrow::Field>> &fields,
+                                      const std::vector<std::vector<std::shared_ptr<arrow::ArrayData>>> &chunks) {
   uint64_t bytes = 0;
 
   std::vector<BufConfig> host_bufs;
   std::vector<BufConfig> dest_bufs;
 
-  // Derive some properties of the column:
-  //int num_chunks = column->data()->num_chunks();
-  auto field = column->field();
-  auto chunks = column->data()->chunks();
+  size_t num_chunks = chunks.size();
+
+  // The length of a chunk is that of its first column
+  if (fields.empty()) {
+    throw std::runtime_error("Nothing to prepare, there are no columns.");
+  }
 
-  // TODO: Support chunks
-  // For now, only chunk 0 is selected
-  //for (auto const &chunk : chunks) {
-  auto chunk = chunks[0];
-  std::vector<BufConfig> chunk_config;
-  append_chunk_buffer_config(chunk->data(), column->field(), chunk_config);
-  host_bufs.insert(host_bufs.end(), chunk_config.begin(), chunk_config.end());
-  //}
+  if (num_chunks == 0) {
+    throw std::runtime_error("Nothing to prepare, there are no chunks.");
+  }
 
-  LOGD("Host side buffers:" << std::endl << ToString(host_bufs));
+  for (size_t c = 0; c < num_chunks; c++) {
+    if (chunks[c].size() != fields.size()) {
+      throw std::runtime_error("Chunk " + std::to_string(c) + " has " + std::to_string(chunks[c].size())
+                                   + " columns, but there are " + std::to_string(fields.size()) + " fields.");
+    }
+  }
+
+  // Gather the buffers of all fields of all chunks, so they can be organized in one go
+  size_t nbufs = 0;
+  for (size_t c = 0; c < num_chunks; c++) {
+    std::vector<BufConfig> chunk_config;
+
+    for (size_t f = 0; f < fields.size(); f++) {
+      // All fields of a chunk must be of equal length
+      if (chunks[c][f]->length != chunks[c][0]->length) {
+        throw std::runtime_error("Chunk " + std::to_string(c) + " of column " + fields[f]->name()
+                                     + " has a different length than the other columns.");
+      }
+      append_chunk_buffer_config(chunks[c][f], fields[f], chunk_config);
+    }
+
+    // Every chunk of the same fields should result in the same buffer layout
+    if (c == 0) {
+      nbufs = chunk_config.size();
+    } else if (chunk_config.size() != nbufs) {
+      throw std::runtime_error("Chunk " + std::to_string(c) + " has a different number of buffers than chunk 0.");
+    }
+
+    host_bufs.insert(host_bufs.end(), chunk_config.begin(), chunk_config.end());
+  }
+
+  // Columns prepared earlier determine the number of chunks and their lengths. The first columns reserve them,
+  // such that columns prepared concurrently are checked against the same chunks before anything is organized.
+  bool reserved = false;
+  {
+    std::lock_guard<std::mutex> guard(this->_lock);
+    if (this->_chunks.empty()) {
+      this->_chunks.resize(num_chunks);
+      for (size_t c = 0; c < num_chunks; c++) {
+        this->_chunks[c].length = chunks[c][0]->length;
+      }
+      reserved = true;
+    } else if (this->_chunks.size() != num_chunks) {
+      throw std::runtime_error("Number of chunks is different from the columns that were prepared before.");
+    } else {
+      for (size_t c = 0; c < num_chunks; c++) {
+        if (this->_chunks[c].length != chunks[c][0]->length) {
+          throw std::runtime_error("Chunk " + std::to_string(c)
+                                       + " has a different length than the chunks that were prepared before.");
+        }
+      }
+    }
+  }
+
+  // Give up the reservation, unless other columns were prepared in it meanwhile; called with the lock held
+  auto drop_reservation = [this, reserved]() {
+    if (!reserved) {
+      return;
+    }
+    bool used = false;
+    for (auto const &chunk : this->_chunks) {
+      used |= !chunk.buffers.empty();
+    }
+    if (!used) {
+      this->_chunks.clear();
+    }
+  };
 
-  bytes += this->organize_buffers(host_bufs, dest_bufs);
+  try {
+    bytes += this->timed_organize_buffers(host_bufs, dest_bufs);
+  } catch (...) {
+    std::lock_guard<std::mutex> guard(this->_lock);
+    drop_reservation();
+    throw;
+  }
 
+  LOGD("Host side buffers:" << std::endl << ToString(host_bufs));
   LOGD("Destination buffers: " << std::endl << ToString(dest_bufs));
 
-  size_t nbufs = host_bufs.size();
+  // Organizing may take long and is done by the platform in parallel; only the bookkeeping is serialized
+  std::unique_lock<std::mutex> lock(this->_lock);
+
+  // Platforms in their error state organize nothing
+  if (dest_bufs.size() != host_bufs.size()) {
+    drop_reservation();
+    lock.unlock();
+    this->free_buffers(dest_bufs);
+    throw std::runtime_error("Platform organized " + std::to_string(dest_bufs.size()) + " of "
+                                 + std::to_string(host_bufs.size()) + " buffers.");
+  }
+
+  // The chunks may have been cleared while organizing
+  if (this->_chunks.size() != num_chunks) {
+    lock.unlock();
+    this->free_buffers(dest_bufs);
+    throw std::runtime_error("Prepared chunks were cleared while preparing more columns.");
+  }
+
+  // Compute the buffer register map of the first chunk and program it in one pass
+  std::vector<fr_t> buffer_regs(nbufs);
+  for (size_t i = 0; i < nbufs; i++) {
+    buffer_regs[i] = dest_bufs[i].address;
+  }
+
+  // Columns are prepared in window 0, after the columns that were prepared before
+  auto inserted = this->_argument_offsets.insert({0, UC_REG_BUFFERS});
+  uint64_t &offset = inserted.first->second;
+
+  if (write_mmio_batch(offset, buffer_regs.data(), buffer_regs.size()) != OK) {
+    drop_reservation();
+    lock.unlock();
+    this->free_buffers(dest_bufs);
+    throw std::runtime_error("Could not write the buffer address registers.");
+  }
+
+  // Distribute the destination buffers over the chunks
+  for (size_t c = 0; c < num_chunks; c++) {
+    auto first = dest_bufs.begin() + c * nbufs;
+    this->_chunks[c].buffers.insert(this->_chunks[c].buffers.end(), first, first + nbufs);
+  }
+
+  offset += nbufs;
+
+  LOGD("Configured " << nbufs << " buffers of " << fields.size() << " field(s) for " << num_chunks << " chunk(s). "
+                     "Argument offset starting at " << offset);
+
+  return bytes;
+}
+
+size_t FPGAPlatform::num_chunks() {
+  std::lock_guard<std::mutex> guard(this->_lock);
+  return this->_chunks.size();
+}
+
+ChunkConfig FPGAPlatform::chunk_config(size_t chunk) {
+  std::lock_guard<std::mutex> guard(this->_lock);
+  if (chunk >= this->_chunks.size()) {
+    throw std::runtime_error("Chunk " + std::to_string(chunk) + " was not prepared.");
+  }
+  return this->_chunks[chunk];
+}
+
+int FPGAPlatform::select_chunk(size_t chunk, uint64_t window) {
+  std::vector<fr_t> buffer_regs;
+  {
+    std::lock_guard<std::mutex> guard(this->_lock);
+    if (chunk >= this->_chunks.size()) {
+      throw std::runtime_error("Chunk " + std::to_string(chunk) + " was not prepared.");
+    }
+    for (auto const &buffer : this->_chunks[chunk].buffers) {
+      buffer_regs.push_back(buffer.address);
+    }
+    this->_argument_offsets[window] = window + UC_REG_BUFFERS + buffer_regs.size();
+  }
+
+  return write_mmio_batch(window + UC_REG_BUFFERS, buffer_regs.data(), buffer_regs.size());
+}
+
+uint64_t FPGAPlatform::stage_recordbatch(const std::shared_ptr<arrow::RecordBatch> &record_batch,
+                                         std::vector<BufConfig> &dest_buffers) {
+  std::vector<BufConfig> host_bufs;
 
-  this->_argument_offset += nbufs;
+  for (int f = 0; f < record_batch->num_columns(); f++) {
+    append_chunk_buffer_config(record_batch->column_data(f), record_batch->schema()->field(f), host_bufs);
+  }
+
+  uint64_t bytes = this->timed_organize_buffers(host_bufs, dest_buffers);
+
+  LOGD("Staged " << host_bufs.size() << " buffers.");
+
+  return bytes;
+}
 
-  LOGD("Configured " << nbufs << " buffers. " "Argument offset starting at " << this->argument_offset());
+uint64_t FPGAPlatform::stage_buffers(const std::vector<BufConfig> &host_buffers,
+                                     std::vector<BufConfig> &dest_buffers) {
+  uint64_t bytes = this->timed_organize_buffers(host_buffers, dest_buffers);
+
+  LOGD("Staged " << host_buffers.size() << " buffers.");
 
   return bytes;
 }
 
-uint64_t FPGAPlatform::argument_offset() {
-  if (this->_argument_offset == UC_REG_BUFFERS) {
+void FPGAPlatform::release_buffers(const std::vector<BufConfig> &dest_buffers) {
+  this->free_buffers(dest_buffers);
+}
+
+void FPGAPlatform::clear_prepared() {
+  std::vector<ChunkConfig> chunks;
+  {
+    std::lock_guard<std::mutex> guard(this->_lock);
+    chunks.swap(this->_chunks);
+    this->_argument_offsets.erase(0);
+  }
+  for (auto const &chunk : chunks) {
+    this->free_buffers(chunk.buffers);
+  }
+}
+
+int FPGAPlatform::activate_buffers(const std::vector<BufConfig> &dest_buffers, uint64_t window) {
+  std::vector<fr_t> buffer_regs(dest_buffers.size());
+  for (size_t i = 0; i < dest_buffers.size(); i++) {
+    buffer_regs[i] = dest_buffers[i].address;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(this->_lock);
+    this->_argument_offsets[window] = window + UC_REG_BUFFERS + dest_buffers.size();
+  }
+
+  return write_mmio_batch(window + UC_REG_BUFFERS, buffer_regs.data(), buffer_regs.size());
+}
+
+int FPGAPlatform::write_mmio_batch(uint64_t offset, const fr_t *values, size_t count) {
+  int rc = OK;
+
+  for (size_t i = 0; i < count; i++) {
+    if (this->write_mmio(offset + i, values[i]) != OK) {
+      rc = ERROR;
+    }
+  }
+
+  return rc;
+}
+
+int FPGAPlatform::read_mmio_batch(uint64_t offset, fr_t *dest, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (this->read_mmio(offset + i, &dest[i]) != OK) {
+      return ERROR;
+    }
+  }
+
+  return OK;
+}
+
+uint64_t FPGAPlatform::argument_offset(uint64_t window) {
+  std::lock_guard<std::mutex> guard(this->_lock);
+  auto offset = this->_argument_offsets.find(window);
+  if (offset == this->_argument_offsets.end() || offset->second == window + UC_REG_BUFFERS) {
     throw std::runtime_error("Argument offset is still at buffer offset."
                              "Prepare at least one buffer before requesting "
                              "argument offset.");
   }
-  return this->_argument_offset;
+  return offset->second;
 }
 
 std::string FPGAPlatform::name() {
   return this->_name;
 }
 
+/// Configure a buffer allocated for a slice, which the configuration keeps alive
+static BufConfig owned_buffer(const std::string &name, const std::shared_ptr<arrow::Buffer> &buffer) {
+  return {name, (fa_t) buffer->data(), buffer->size(), buffer->capacity(), buffer};
+}
+
+static std::shared_ptr<arrow::Buffer> allocate_slice_buffer(const std::string &name, int64_t size) {
+  std::shared_ptr<arrow::Buffer> buffer;
+  if (!arrow::AllocateBuffer(arrow::default_memory_pool(), size, &buffer).ok()) {
+    throw std::runtime_error("Could not allocate " + std::to_string(size) + " bytes for " + name + ".");
+  }
+  return buffer;
+}
+
+/// Return true if a buffer has no memory, which Arrow allows for buffers that hold nothing
+static bool is_absent(const std::shared_ptr<arrow::Buffer> &buffer) {
+  return (buffer == nullptr) || (buffer->data() == nullptr);
+}
+
+/// Configure the bytes [first, first + size) of a buffer, without copying
+static BufConfig buffer_range(const std::string &name,
+                              const std::shared_ptr<arrow::Buffer> &buffer,
+                              int64_t first,
+                              int64_t size) {
+  // Still give the UserCore an address, rather than 0, if nothing is configured from an absent buffer
+  if (is_absent(buffer) && (size == 0)) {
+    return owned_buffer(name, allocate_slice_buffer(name, 0));
+  }
+  int64_t available = is_absent(buffer) ? 0 : buffer->size();
+  if (first + size > available) {
+    throw std::runtime_error("Buffer " + name + " of " + std::to_string(available)
+                                 + " bytes is too small for bytes " + std::to_string(first) + " to "
+                                 + std::to_string(first + size) + ".");
+  }
+  // Keep the padding Arrow would have allocated for a buffer of this size, if it is there
+  int64_t capacity = std::min(buffer->capacity() - first, arrow::BitUtil::RoundUpToMultipleOf64(size));
+  return {name, (fa_t) (buffer->data() + first), size, capacity, nullptr};
+}
+
+/**
+ * Configure length bits of a bitmap, starting at bit offset. Bitmaps that do
+ * not start at a byte boundary are shifted into a new buffer. An absent
+ * validity bitmap, which Arrow allows when there are no nulls, results in a
+ * bitmap of all ones.
+ */
+static BufConfig bitmap_range(const std::string &name,
+                              const std::shared_ptr<arrow::Buffer> &bitmap,
+                              int64_t offset,
+                              int64_t length) {
+  int64_t bytes = arrow::BitUtil::BytesForBits(length);
+
+  if (bitmap != nullptr && offset % 8 == 0) {
+    return buffer_range(name, bitmap, offset / 8, bytes);
+  }
+
+  if ((bitmap != nullptr) && (length > 0)
+      && (is_absent(bitmap) || (arrow::BitUtil::BytesForBits(offset + length) > bitmap->size()))) {
+    throw std::runtime_error("Bitmap " + name + " is too small for bits " + std::to_string(offset) + " to "
+                                 + std::to_string(offset + length) + ".");
+  }
+
+  auto shifted = allocate_slice_buffer(name, bytes);
+  auto dest = const_cast<uint8_t *>(shifted->data());
+
+  if (bitmap == nullptr) {
+    memset(dest, 0xFF, static_cast<size_t>(bytes));
+  } else {
+    memset(dest, 0, static_cast<size_t>(bytes));
+    for (int64_t i = 0; i < length; i++) {
+      if (arrow::BitUtil::GetBit(bitmap->data(), offset + i)) {
+        arrow::BitUtil::SetBit(dest, i);
+      }
+    }
+  }
+
+  return owned_buffer(name, shifted);
+}
+
+/**
+ * Configure the length + 1 offsets of a list, string or binary slice,
+ * starting at element offset. If the first offset is not zero, the offsets
+ * are rebased into a new buffer, such that they index the values of the
+ * slice only. The range of values the slice covers is returned in first and
+ * last.
+ */
+static BufConfig offsets_range(const std::string &name,
+                               const std::shared_ptr<arrow::Buffer> &buffer,
+                               int64_t offset,
+                               int64_t length,
+                               int32_t &first,
+                               int32_t &last) {
+  int64_t bytes = (length + 1) * static_cast<int64_t>(sizeof(int32_t));
+
+  // Arrays without elements may come without offsets, while the UserCore still expects the one offset of zero
+  if (is_absent(buffer) && (length == 0)) {
+    auto zero = allocate_slice_buffer(name, bytes);
+    *reinterpret_cast<int32_t *>(const_cast<uint8_t *>(zero->data())) = 0;
+    first = 0;
+    last = 0;
+    return owned_buffer(name, zero);
+  }
+
+  auto config = buffer_range(name, buffer, offset * static_cast<int64_t>(sizeof(int32_t)), bytes);
+
+  auto offsets = reinterpret_cast<const int32_t *>(config.address);
+  first = offsets[0];
+  last = offsets[length];
+
+  if (first == 0) {
+    return config;
+  }
+
+  auto rebased = allocate_slice_buffer(name, bytes);
+  auto dest = reinterpret_cast<int32_t *>(const_cast<uint8_t *>(rebased->data()));
+  for (int64_t i = 0; i <= length; i++) {
+    dest[i] = offsets[i] - first;
+  }
+
+  return owned_buffer(name, rebased);
+}
+
+void FPGAPlatform::append_chunk_buffer_config(const std::shared_ptr<arrow::ArrayData> &array_data,
+                                              const std::shared_ptr<arrow::Field> &field,
+                                              std::vector<BufConfig> &config_vector,
+                                              uint depth) {
+  append_chunk_buffer_config(array_data, field, array_data->offset, array_data->length, config_vector, depth);
+}
+
 /*
  * The default implementation of Arrow always allocates a validity bitmap, even 
  * when a field is specified for which nullable=false. Thus, we need the field 
@@ -78,15 +476,24 @@ std::string FPGAPlatform::name() {
  * the ArrayData holds three buffers. There, the list elements themselves are 
  * always valid and in fact no validity bitmap is allocated at all.
  *
+ * Only the part of the buffers that the elements [offset, offset + length)
+ * cover is configured, such that slices of larger arrays don't expose the
+ * complete buffers of their parent. Where possible, the configuration points
+ * into the original buffers. The first element of the slice becomes element
+ * zero for the UserCore.
+ *
  * TODO: This quirky implementation should be improved.
  */
 void FPGAPlatform::append_chunk_buffer_config(const std::shared_ptr<arrow::ArrayData> &array_data,
                                               const std::shared_ptr<arrow::Field> &field,
+                                              int64_t offset,
+                                              int64_t length,
                                               std::vector<BufConfig> &config_vector,
                                               uint depth) {
   LOGD(std::string(depth, '\t') << "Chunk (ArrayData):");
   LOGD(std::string(depth, '\t') << "\tType: " << array_data->type->ToString());
   LOGD(std::string(depth, '\t') << "\tBuffers: " << array_data->buffers.size());
+  LOGD(std::string(depth, '\t') << "\tElements: " << offset << " to " << offset + length);
 
 #ifdef PRINT_BUFFERS
   for (int b = 0; b < array_data->buffers.size(); b++) {
@@ -96,71 +503,198 @@ void FPGAPlatform::append_chunk_buffer_config(const std::shared_ptr<arrow::Array
   }
 #endif
 
+  auto type = field->type();
+
   // Check if this ArrayData has buffers
   if (!array_data->buffers.empty()) {
-    BufConfig vbm, off, dat;
-    // Append each buffer to the vector of Buffer Addresses
-    switch (array_data->buffers.size()) {
-      default:throw std::runtime_error("ArrayData contains 0 buffers.");
+    // The first buffer is the validity bitmap, but we only add it to the list
+    // if the field is actually nullable
+    if (field->nullable()) {
+      config_vector.push_back(bitmap_range("vbmp " + field->name(), array_data->buffers[0], offset, length));
+    }
+
+    switch (type->id()) {
+      case arrow::Type::STRUCT:
+        // There is one buffer, which is the validity bitmap
         break;
-      case 1:
-        if (field->nullable()) {
-          // There is one buffer and the field is nullable, it must be the
-          // validity bitmap of a struct
-          vbm = {"vbmp " + field->name(), (fa_t) array_data->buffers[0]->data(),
-                 array_data->buffers[0]->size(), array_data->buffers[0]->capacity()};
-          config_vector.push_back(vbm);
-        }
+
+      case arrow::Type::LIST: {
+        // The second buffer holds the offsets, the values are in the child
+        int32_t first, last;
+        config_vector.push_back(offsets_range("offs " + field->name(), array_data->buffers[1], offset, length,
+                                              first, last));
+
+        auto array_child = array_data->child_data[0];
+        LOGD(std::string(depth, '\t') << "\tChildren: 1");
+        append_chunk_buffer_config(array_child, type->child(0), array_child->offset + first, last - first,
+                                   config_vector, depth + 1);
+        return;
+      }
+
+      case arrow::Type::STRING:
+      case arrow::Type::BINARY: {
+        // If there are three buffers, the second is an offset buffer and the
+        // third one is the data buffer.
+        int32_t first, last;
+        config_vector.push_back(offsets_range("offs " + field->name(), array_data->buffers[1], offset, length,
+                                              first, last));
+        config_vector.push_back(buffer_range("data " + field->name(), array_data->buffers[2], first, last - first));
         break;
-      case 2:
-        // There are two buffers, the first one is always the validity bitmap but
-        // we only add it to the list if the field is actually nullable
-        if (field->nullable()) {
-          vbm = {"vbmp " + field->name(), (fa_t) array_data->buffers[0]->data(),
-                 array_data->buffers[0]->size(), array_data->buffers[0]->capacity()};
-          config_vector.push_back(vbm);
+      }
+
+      default: {
+        // The second buffer is the data buffer
+        auto fixed_width = std::dynamic_pointer_cast<arrow::FixedWidthType>(type);
+        if (!fixed_width || array_data->buffers.size() != 2) {
+          throw std::runtime_error("Cannot prepare field " + field->name() + " of type " + type->ToString() + ".");
         }
-        // If there are two buffers, the second one is the data buffer, unless
-        // this is a list
-        if (field->type()->id() == arrow::Type::LIST) {
-          off = {"offs " + field->name(), (fa_t) array_data->buffers[1]->data(),
-                 array_data->buffers[1]->size(), array_data->buffers[1]->capacity()};
-          config_vector.push_back(off);
+        int bit_width = fixed_width->bit_width();
+        if (bit_width % 8 == 0) {
+          config_vector.push_back(buffer_range("data " + field->name(), array_data->buffers[1],
+                                               offset * (bit_width / 8), length * (bit_width / 8)));
         } else {
-          dat = {"data " + field->name(), (fa_t) array_data->buffers[1]->data(),
-                 array_data->buffers[1]->size(), array_data->buffers[1]->capacity()};
-          config_vector.push_back(dat);
-        }
-        break;
-      case 3:
-        // If there are three buffers, the first one is the validity bitmap, the
-        // second is an offset buffer and the third one is the data buffer. This
-        // happens with strings and binary data.
-        if (field->nullable()) {
-          vbm = {" " + field->name(), (fa_t) array_data->buffers[0]->data(),
-                 array_data->buffers[0]->size(), array_data->buffers[0]->capacity()};
-          config_vector.push_back(vbm);
+          // Booleans are stored as a bitmap
+          config_vector.push_back(bitmap_range("data " + field->name(), array_data->buffers[1],
+                                               offset * bit_width, length * bit_width));
         }
-        off = {"offs " + field->name(), (fa_t) array_data->buffers[1]->data(),
-               array_data->buffers[1]->size(), array_data->buffers[1]->capacity()};
-        config_vector.push_back(off);
-        dat = {"data " + field->name(), (fa_t) array_data->buffers[2]->data(),
-               array_data->buffers[2]->size(), array_data->buffers[2]->capacity()};
-        config_vector.push_back(dat);
         break;
+      }
     }
   }
 
   LOGD(std::string(depth, '\t') << "\tChildren: " << array_data->child_data.size());
 
-  // Check if chunk has child data (for lists and structs)
-  if (!array_data->child_data.empty()) {
-    for (unsigned int c = 0; c < array_data->child_data.size(); c++) {
-      auto array_child = array_data->child_data[c];
-      auto field_child = field->type()->child(c);
-      append_chunk_buffer_config(array_child, field_child, config_vector, depth + 1);
+  // The children of a struct are not sliced themselves, but share the window
+  // of their parent
+  for (unsigned int c = 0; c < array_data->child_data.size(); c++) {
+    auto array_child = array_data->child_data[c];
+    append_chunk_buffer_config(array_child, type->child(c), array_child->offset + offset, length,
+                               config_vector, depth + 1);
+  }
+}
+
+uint64_t FPGAPlatform::timed_organize_buffers(const std::vector<BufConfig> &source_buffers,
+                                             std::vector<BufConfig> &dest_buffers) {
+  ScopedTimer timer(organize_time);
+  uint64_t bytes = this->organize_buffers(source_buffers, dest_buffers);
+  organized_bytes.add(bytes);
+  return bytes;
+}
+
+DmaMemoryPool *FPGAPlatform::memory_pool() {
+  return dma_memory_pool(numa_node());
+}
+
+uint64_t FPGAPlatform::copy_from_device(fa_t address, uint8_t *dest, uint64_t bytes) {
+  memcpy(dest, reinterpret_cast<const void *>(address), bytes);
+  return bytes;
+}
+
+std::shared_ptr<arrow::Array> FPGAPlatform::read_array(const std::shared_ptr<arrow::Field> &field,
+                                                       int64_t length,
+                                                       const std::vector<BufConfig> &device_buffers,
+                                                       arrow::MemoryPool *pool) {
+  size_t next = 0;
+  auto data = read_array_data(field, length, device_buffers, next, pool);
+
+  if (next != device_buffers.size()) {
+    LOGE("Read " << next << " device buffers for field " << field->name() << ", but " << device_buffers.size()
+                 << " were supplied.");
+  }
+
+  return arrow::MakeArray(data);
+}
+
+/*
+ * Buffers are consumed in the same order as append_chunk_buffer_config
+ * produces them: the validity bitmap of nullable fields, then the offsets
+ * of lists, strings and binaries, then the data. Children of lists and
+ * structs follow their parent.
+ */
+std::shared_ptr<arrow::ArrayData> FPGAPlatform::read_array_data(const std::shared_ptr<arrow::Field> &field,
+                                                                int64_t length,
+                                                                const std::vector<BufConfig> &device_buffers,
+                                                                size_t &next,
+                                                                arrow::MemoryPool *pool) {
+  auto type = field->type();
+
+  std::vector<std::shared_ptr<arrow::Buffer>> buffers;
+  std::vector<std::shared_ptr<arrow::ArrayData>> children;
+
+  auto take = [&]() -> const BufConfig & {
+    if (next >= device_buffers.size()) {
+      throw std::runtime_error("Not enough device buffers to read field " + field->name() + ".");
+    }
+    return device_buffers[next++];
+  };
+
+  // Validity bitmap
+  int64_t null_count = 0;
+  std::shared_ptr<arrow::Buffer> validity;
+  if (field->nullable()) {
+    validity = read_buffer(take(), arrow::BitUtil::BytesForBits(length), pool);
+    null_count = arrow::kUnknownNullCount;
+  }
+  buffers.push_back(validity);
+
+  switch (type->id()) {
+    case arrow::Type::STRING:
+    case arrow::Type::BINARY:
+    case arrow::Type::LIST: {
+      // The offsets determine the number of values
+      auto offsets = read_buffer(take(), (length + 1) * static_cast<int64_t>(sizeof(int32_t)), pool);
+      buffers.push_back(offsets);
+      int64_t num_values = reinterpret_cast<const int32_t *>(offsets->data())[length];
+
+      if (type->id() == arrow::Type::LIST) {
+        children.push_back(read_array_data(type->child(0), num_values, device_buffers, next, pool));
+      } else {
+        buffers.push_back(read_buffer(take(), num_values, pool));
+      }
+      break;
+    }
+
+    case arrow::Type::STRUCT:
+      for (int c = 0; c < type->num_children(); c++) {
+        children.push_back(read_array_data(type->child(c), length, device_buffers, next, pool));
+      }
+      break;
+
+    default: {
+      auto fixed_width = std::dynamic_pointer_cast<arrow::FixedWidthType>(type);
+      if (!fixed_width) {
+        throw std::runtime_error("Cannot read back field " + field->name() + " of type " + type->ToString() + ".");
+      }
+      buffers.push_back(read_buffer(take(), arrow::BitUtil::BytesForBits(length * fixed_width->bit_width()), pool));
+      break;
     }
   }
+
+  auto data = std::make_shared<arrow::ArrayData>(type, length, buffers, null_count);
+  data->child_data = children;
+
+  return data;
+}
+
+std::shared_ptr<arrow::Buffer> FPGAPlatform::read_buffer(const BufConfig &device_buffer,
+                                                         int64_t size,
+                                                         arrow::MemoryPool *pool) {
+  if ((device_buffer.capacity > 0) && (size > device_buffer.capacity)) {
+    throw std::runtime_error("Device buffer " + device_buffer.name + " holds " + std::to_string(size)
+                                 + " bytes, exceeding its capacity of " + std::to_string(device_buffer.capacity)
+                                 + " bytes.");
+  }
+
+  std::shared_ptr<arrow::Buffer> buffer;
+  if (!arrow::AllocateBuffer(pool, size, &buffer).ok()) {
+    throw std::runtime_error("Could not allocate " + std::to_string(size) + " bytes for " + device_buffer.name + ".");
+  }
+
+  if (size > 0) {
+    readback_bytes.add(this->copy_from_device(device_buffer.address, buffer->mutable_data(), static_cast<uint64_t>(size)));
+  }
+
+  return buffer;
 }
 
 std::string ToString(std::vector<BufConfig> &bc) {
@@ -15,12 +15,15 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include <arrow/api.h>
 
 #include "common.h"
+#include "DmaMemoryPool.h"
 
 /// The status register and bits
 #define UC_REG_STATUS   0
@@ -50,6 +53,17 @@ namespace fletcher {
  * a UserCore to write/read memory mapped slave registers and to
  * organize buffers. This may or may not include copying the Arrow
  * buffers to some on-board memory.
+ *
+ * An image may contain several UserCores, each with its own window of
+ * registers. A register window is identified by the offset of its status
+ * register; all other registers of the UserCore follow at the offsets
+ * defined above, relative to the window. Window 0 is the UserCore of a
+ * single-core image.
+ *
+ * A platform may be shared by several threads, each driving the UserCore
+ * of a different window. Implementations must make register access and
+ * buffer organization thread-safe, serializing MMIO only where the
+ * hardware or its driver requires it.
  */
 class FPGAPlatform
 {
@@ -68,20 +82,194 @@ class FPGAPlatform
    */
   virtual int read_mmio(uint64_t offset, fr_t* dest)=0;
 
+  /**
+   * \brief Write count 64-bit values to a contiguous range of memory mapped
+   * slave registers, starting at some offset (address).
+   *
+   * The default implementation writes the registers one by one. Platforms
+   * of which the SDK supports burst transfers should override this.
+   */
+  virtual int write_mmio_batch(uint64_t offset, const fr_t* values, size_t count);
+
+  /**
+   * \brief Read count 64-bit values from a contiguous range of memory
+   * mapped slave registers, starting at some offset (address), into dest.
+   *
+   * The default implementation reads the registers one by one.
+   */
+  virtual int read_mmio_batch(uint64_t offset, fr_t* dest, size_t count);
+
+  /**
+   * \brief Copy bytes written by the FPGA at some device address to host
+   * memory.
+   *
+   * The default implementation is for platforms where the FPGA accesses
+   * host memory directly, and device addresses are host addresses.
+   * \return the number of bytes copied
+   */
+  virtual uint64_t copy_from_device(fa_t address, uint8_t* dest, uint64_t bytes);
+
+  /**
+   * \brief Returns true if the FPGA can access host memory at host
+   * addresses, e.g. to write output buffers directly.
+   */
+  virtual bool host_memory_access() { return false; }
+
+  /**
+   * \brief Returns true if the UserCore controller fetches commands from a
+   * CommandRing, and writes its completion records.
+   *
+   * Host memory access alone is not enough: without a controller that
+   * drives the ring registers, nothing ever consumes the commands. No
+   * hardware platform has such a controller yet; only the simulator does.
+   */
+  virtual bool command_ring_supported() { return false; }
+
+  /**
+   * \brief Returns the NUMA node the FPGA is attached to, or
+   * NUMA_NODE_NONE if it is unknown.
+   */
+  virtual int numa_node() { return NUMA_NODE_NONE; }
+
+  /**
+   * \brief Returns a pool that allocates DMA-ready memory on the NUMA node
+   * of the FPGA, to build tables in that are transferred to it.
+   *
+   * The pool is shared by all platforms on the same node and outlives
+   * them.
+   */
+  DmaMemoryPool* memory_pool();
+
+  /**
+   * \brief Read buffers written by the FPGA back into an Arrow array.
+   *
+   * The device buffers are copied into buffers allocated from an Arrow
+   * MemoryPool, which are then wrapped as an arrow::Array without any
+   * further copies.
+   *
+   * \param field          The field of the array.
+   * \param length         The number of elements of the array.
+   * \param device_buffers The device buffers, in the same order as the
+   *                       buffers of a prepared chunk of this field. Their
+   *                       sizes are derived from the field type and length,
+   *                       and from the offsets for lists and strings.
+   * \param pool           The MemoryPool to allocate host buffers from.
+   */
+  std::shared_ptr<arrow::Array> read_array(const std::shared_ptr<arrow::Field>& field,
+                                           int64_t length,
+                                           const std::vector<BufConfig>& device_buffers,
+                                           arrow::MemoryPool* pool = arrow::default_memory_pool());
+
   /**
    * \brief Prepare the chunks of a column.
    * 
    * This may or may not include a copy to some on-board memory, 
-   * depending on the type of platform uses.
+   * depending on the type of platform uses. All chunks are prepared, but
+   * the buffer address registers initially point to the first chunk. Use
+   * select_chunk() to point them to another chunk.
    * \return the number of bytes prepared for all buffers in this column
    */
   uint64_t prepare_column_chunks(const std::shared_ptr<arrow::Column>& column);
 
+  /**
+   * \brief Prepare all columns of a RecordBatch.
+   *
+   * The buffers of all fields are organized in one go, after which the
+   * complete buffer address register map is programmed in one pass.
+   * \return the number of bytes prepared for all buffers in this RecordBatch
+   */
+  uint64_t prepare_recordbatch(const std::shared_ptr<arrow::RecordBatch>& record_batch);
+
+  /**
+   * \brief Prepare all columns of a Table.
+   *
+   * Like prepare_recordbatch, but every column must consist of the same
+   * number of chunks. Chunk c of all columns forms the c-th chunk that
+   * can be selected with select_chunk().
+   * \return the number of bytes prepared for all buffers in this Table
+   */
+  uint64_t prepare_table(const std::shared_ptr<arrow::Table>& table);
+
+  /**
+   * \brief Return the number of prepared chunks.
+   */
+  size_t num_chunks();
+
+  /**
+   * \brief Return a copy of the configuration of a prepared chunk.
+   *
+   * A copy, as other threads may prepare more columns meanwhile. Its
+   * buffers are valid until clear_prepared() is called.
+   */
+  ChunkConfig chunk_config(size_t chunk);
+
+  /**
+   * \brief Point the buffer address registers of all prepared columns to
+   * the buffers of a specific chunk.
+   *
+   * The prepared buffers are only read by the FPGA, so the UserCores of
+   * several register windows may select chunks of the same columns.
+   */
+  int select_chunk(size_t chunk, uint64_t window = 0);
+
+  /**
+   * \brief Organize the buffers of a RecordBatch, without writing the
+   * buffer address registers.
+   *
+   * This is used to copy the next batch to the device while the UserCore
+   * is still working on the current batch. On platforms with on-board
+   * memory, the staged buffers occupy device memory until they are
+   * released with release_buffers().
+   *
+   * \param record_batch The RecordBatch to stage.
+   * \param dest_buffers A vector to append the destination buffers to.
+   * \return the number of bytes staged
+   */
+  uint64_t stage_recordbatch(const std::shared_ptr<arrow::RecordBatch>& record_batch,
+                             std::vector<BufConfig>& dest_buffers);
+
+  /**
+   * \brief Organize arbitrary host buffers, without writing the buffer
+   * address registers.
+   *
+   * Only the first size bytes of every buffer are copied, but capacity
+   * bytes are reserved on the device, e.g. for buffers the UserCore writes.
+   *
+   * \param host_buffers The host buffers to stage.
+   * \param dest_buffers A vector to append the destination buffers to.
+   * \return the number of bytes staged
+   */
+  uint64_t stage_buffers(const std::vector<BufConfig>& host_buffers,
+                         std::vector<BufConfig>& dest_buffers);
+
+  /**
+   * \brief Release destination buffers obtained from stage_recordbatch()
+   * or stage_buffers(), such that their device memory may be reused.
+   */
+  void release_buffers(const std::vector<BufConfig>& dest_buffers);
+
+  /**
+   * \brief Release the buffers of all prepared columns and start over.
+   *
+   * After this, new columns are prepared starting from the first buffer
+   * address register again.
+   */
+  void clear_prepared();
+
+  /**
+   * \brief Point the buffer address registers of a register window to
+   * staged buffers.
+   *
+   * This replaces any columns that were prepared before; the argument
+   * offset of the window starts directly after the staged buffers.
+   */
+  int activate_buffers(const std::vector<BufConfig>& dest_buffers, uint64_t window = 0);
+
   /**
    * \brief The offset of the first memory-mapped slave register 
-   * argument.
+   * argument of a register window.
    */
-  uint64_t argument_offset();
+  uint64_t argument_offset(uint64_t window = 0);
 
   /**
    * \brief Return the name of this platform
@@ -94,22 +282,52 @@ class FPGAPlatform
   virtual bool good()=0;
 
  private:
-  uint64_t _argument_offset = UC_REG_BUFFERS;
+  /// Protects the prepared chunks and the argument offsets
+  std::mutex _lock;
+
+  /// The argument offset of every register window that has buffers
+  std::map<uint64_t, uint64_t> _argument_offsets;
 
   std::string _name = "Anonymous Platform";
 
+  /// Destination buffers of all prepared columns, per chunk
+  std::vector<ChunkConfig> _chunks;
+
+  /**
+   * \brief Prepare the chunks of a set of fields.
+   *
+   * \param fields The fields of the columns to prepare.
+   * \param chunks For every chunk, the ArrayData of every field.
+   * \return the number of bytes prepared
+   */
+  uint64_t prepare_chunks(const std::vector<std::shared_ptr<arrow::Field>>& fields,
+                          const std::vector<std::vector<std::shared_ptr<arrow::ArrayData>>>& chunks);
+
   /**
    * \brief Function to organize buffers for the specific FPGA Platform.
    * 
    * \param source_buffers A vector of buffer configurations of all 
    *        source buffers to be organized for the FPGA platform.
    * \param dest_buffers A vector to append the buffer configurations
-   *        on the FPGA platform for.
+   *        on the FPGA platform for, in the same order as source_buffers.
+   *        The buffer address registers are written by the caller.
    * \return the number of bytes organized
    */
   virtual uint64_t organize_buffers(const std::vector<BufConfig>& source_buffers,
                                     std::vector<BufConfig>& dest_buffers)=0;
 
+  /// Call organize_buffers and record its time and bytes in the metrics
+  uint64_t timed_organize_buffers(const std::vector<BufConfig>& source_buffers,
+                                  std::vector<BufConfig>& dest_buffers);
+
+  /**
+   * \brief Function to free buffers organized by organize_buffers.
+   *
+   * Platforms that allocate memory for the destination buffers should
+   * override this. By default, nothing is freed.
+   */
+  virtual void free_buffers(const std::vector<BufConfig>& /* dest_buffers */) {}
+
   /**
    * Append a BufConfig vector with all ArrayData buffers that are used 
    * specified by an arrow::Field
@@ -127,6 +345,35 @@ class FPGAPlatform
                                   const std::shared_ptr<arrow::Field>& field,
                                   std::vector<BufConfig>& config_vector,
                                   uint depth = 1);
+
+  /**
+   * Like above, but only for the elements [offset, offset + length) of the
+   * ArrayData buffers, e.g. those of a slice.
+   */
+  void append_chunk_buffer_config(const std::shared_ptr<arrow::ArrayData>& array_data,
+                                  const std::shared_ptr<arrow::Field>& field,
+                                  int64_t offset,
+                                  int64_t length,
+                                  std::vector<BufConfig>& config_vector,
+                                  uint depth);
+
+  /**
+   * Read the ArrayData of a field from device buffers, starting at
+   * device_buffers[next]. next is advanced past the buffers consumed.
+   */
+  std::shared_ptr<arrow::ArrayData> read_array_data(const std::shared_ptr<arrow::Field>& field,
+                                                    int64_t length,
+                                                    const std::vector<BufConfig>& device_buffers,
+                                                    size_t& next,
+                                                    arrow::MemoryPool* pool);
+
+  /**
+   * Read a single device buffer of some size into a buffer allocated from
+   * pool.
+   */
+  std::shared_ptr<arrow::Buffer> read_buffer(const BufConfig& device_buffer,
+                                             int64_t size,
+                                             arrow::MemoryPool* pool);
 };
 
 std::string ToString(std::shared_ptr<arrow::Buffer> buf, int width = 64);
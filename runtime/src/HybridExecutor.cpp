@@ -0,0 +1,259 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#include "logging.h"
+#include "HybridExecutor.h"
+
+namespace fletcher {
+
+typedef std::chrono::steady_clock hybrid_clock;
+
+static inline double seconds_since(hybrid_clock::time_point start) {
+  return std::chrono::duration<double>(hybrid_clock::now() - start).count();
+}
+
+/// Weight of the last run in the throughput estimates
+static const double throughput_weight = 0.5;
+
+static inline void update_throughput(double &estimate, uint64_t rows, double seconds) {
+  if ((rows == 0) || (seconds <= 0.0)) {
+    return;
+  }
+  double measured = rows / seconds;
+  estimate = estimate == 0.0 ? measured : (1.0 - throughput_weight) * estimate + throughput_weight * measured;
+}
+
+HybridExecutor::HybridExecutor(std::shared_ptr<FPGAPlatform> platform, UserCore &usercore, unsigned int cpu_threads)
+    : _platform(std::move(platform)), usercore(usercore), _cpu_threads(cpu_threads) {
+  if (this->_cpu_threads == 0) {
+    this->_cpu_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+void HybridExecutor::set_fpga_ranges(unsigned int ranges) {
+  this->fpga_ranges = std::max(1u, ranges);
+}
+
+double HybridExecutor::fpga_share() {
+  if ((this->fpga_throughput == 0.0) || (this->cpu_throughput == 0.0)) {
+    // Nothing is known yet
+    return 0.5;
+  }
+  return this->fpga_throughput / (this->fpga_throughput + this->cpu_throughput);
+}
+
+unsigned int HybridExecutor::cpu_threads() {
+  return this->_cpu_threads;
+}
+
+const HybridStats &HybridExecutor::stats() {
+  return this->_stats;
+}
+
+bool HybridExecutor::next_range(bool fpga, RowRange &range) {
+  std::unique_lock<std::mutex> lock(this->lock);
+
+  // The FPGA may still fail and leave its range to the CPU
+  if (!fpga) {
+    this->ranges_cv.wait(lock, [this]() { return !this->ranges.empty() || !this->fpga_running; });
+  }
+
+  if (this->ranges.empty()) {
+    return false;
+  }
+
+  if (fpga) {
+    range = this->ranges.front();
+    this->ranges.pop_front();
+    this->fpga_took_owned = this->fpga_owned > 0;
+    if (this->fpga_took_owned) {
+      this->fpga_owned--;
+    } else {
+      this->_stats.fpga_stolen++;
+    }
+  } else {
+    if (this->ranges.size() <= this->fpga_owned) {
+      this->fpga_owned--;
+      this->_stats.cpu_stolen++;
+    }
+    range = this->ranges.back();
+    this->ranges.pop_back();
+  }
+
+  return true;
+}
+
+uc_stat HybridExecutor::fpga_work(const arguments_t &arguments,
+                                  const fpga_done_t &fpga_done,
+                                  std::exception_ptr &done_error) {
+  uc_stat result = SUCCESS;
+
+  RowRange range;
+  while (next_range(true, range)) {
+    auto start = hybrid_clock::now();
+    uc_stat stat = FAILURE;
+
+    try {
+      this->usercore.reset();
+      if (this->_platform->select_chunk(range.chunk, this->usercore.window()) == OK
+          && this->usercore.set_arguments(arguments(range)) == SUCCESS) {
+        this->usercore.start();
+        stat = this->usercore.wait_for_finish();
+      }
+    } catch (const std::exception &e) {
+      LOGE("[HybridExecutor] " << e.what());
+    }
+
+    this->_stats.fpga += seconds_since(start);
+
+    if ((stat == SUCCESS) && fpga_done) {
+      try {
+        fpga_done(this->usercore, range);
+      } catch (...) {
+        LOGE("[HybridExecutor] Finishing the FPGA range failed, the CPU processes it instead.");
+        stat = FAILURE;
+        done_error = std::current_exception();
+      }
+    }
+
+    if (stat != SUCCESS) {
+      // Leave this range and the rest to the CPU, undoing the accounting of next_range()
+      std::lock_guard<std::mutex> guard(this->lock);
+      this->ranges.push_front(range);
+      if (this->fpga_took_owned) {
+        this->fpga_owned++;
+      } else {
+        this->_stats.fpga_stolen--;
+      }
+      result = FAILURE;
+      break;
+    }
+
+    this->_stats.fpga_rows += range.last - range.first;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->fpga_running = false;
+  }
+  this->ranges_cv.notify_all();
+
+  return result;
+}
+
+uc_stat HybridExecutor::run(int64_t cpu_rows_per_range,
+                            const arguments_t &arguments,
+                            const fpga_done_t &fpga_done,
+                            const cpu_t &cpu) {
+  if (cpu_rows_per_range <= 0) {
+    throw std::runtime_error("Rows per range must be positive.");
+  }
+
+  this->_stats = HybridStats();
+  this->_stats.fpga_share = fpga_share();
+
+  // The FPGA share of every chunk comes first, the CPU share last
+  std::vector<RowRange> cpu_ranges;
+  this->ranges.clear();
+  for (size_t c = 0; c < this->_platform->num_chunks(); c++) {
+    int64_t length = this->_platform->chunk_config(c).length;
+    auto fpga_length = static_cast<int64_t>(std::llround(this->_stats.fpga_share * length));
+
+    int64_t fpga_range = (fpga_length + this->fpga_ranges - 1) / this->fpga_ranges;
+    for (int64_t first = 0; first < fpga_length; first += fpga_range) {
+      this->ranges.push_back({c, first, std::min(first + fpga_range, fpga_length)});
+    }
+    for (int64_t first = fpga_length; first < length; first += cpu_rows_per_range) {
+      cpu_ranges.push_back({c, first, std::min(first + cpu_rows_per_range, length)});
+    }
+  }
+  this->fpga_owned = this->ranges.size();
+  this->fpga_running = true;
+  this->ranges.insert(this->ranges.end(), cpu_ranges.rbegin(), cpu_ranges.rend());
+
+  LOGD("[HybridExecutor] FPGA share: " << this->_stats.fpga_share << ", " << this->fpga_owned << " FPGA ranges, "
+                                       << cpu_ranges.size() << " CPU ranges on " << this->_cpu_threads
+                                       << " threads.");
+
+  auto run_start = hybrid_clock::now();
+
+  std::vector<uint64_t> cpu_rows(this->_cpu_threads, 0);
+  std::vector<double> cpu_time(this->_cpu_threads, 0.0);
+  std::atomic<bool> cpu_failed(false);
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < this->_cpu_threads; t++) {
+    workers.emplace_back([this, t, &cpu, &cpu_rows, &cpu_time, &cpu_failed, run_start]() {
+      RowRange range;
+      while (next_range(false, range)) {
+        try {
+          cpu(t, range);
+        } catch (const std::exception &e) {
+          LOGE("[HybridExecutor] CPU thread " << t << ": " << e.what());
+          cpu_failed = true;
+          break;
+        }
+        cpu_rows[t] += range.last - range.first;
+        // Not the time of exit, which includes waiting for the FPGA
+        cpu_time[t] = seconds_since(run_start);
+      }
+    });
+  }
+
+  std::exception_ptr done_error;
+  uc_stat fpga_stat = fpga_work(arguments, fpga_done, done_error);
+  if (fpga_stat != SUCCESS) {
+    LOGE("[HybridExecutor] UserCore failed, the CPU processes the remaining rows.");
+  }
+
+  for (auto &w : workers) {
+    w.join();
+  }
+
+  if (done_error) {
+    this->ranges.clear();
+    std::rethrow_exception(done_error);
+  }
+
+  for (size_t t = 0; t < this->_cpu_threads; t++) {
+    this->_stats.cpu_rows += cpu_rows[t];
+    this->_stats.cpu = std::max(this->_stats.cpu, cpu_time[t]);
+  }
+  this->_stats.total = seconds_since(run_start);
+
+  update_throughput(this->fpga_throughput, this->_stats.fpga_rows, this->_stats.fpga);
+  update_throughput(this->cpu_throughput, this->_stats.cpu_rows, this->_stats.cpu);
+
+  LOGD("[HybridExecutor] FPGA: " << this->_stats.fpga_rows << " rows in " << this->_stats.fpga << " s ("
+                                 << this->_stats.fpga_stolen << " ranges stolen), CPU: " << this->_stats.cpu_rows
+                                 << " rows in " << this->_stats.cpu << " s (" << this->_stats.cpu_stolen
+                                 << " ranges stolen). Next FPGA share: " << fpga_share());
+
+  if (cpu_failed || !this->ranges.empty()) {
+    this->ranges.clear();
+    return FAILURE;
+  }
+
+  return SUCCESS;
+}
+
+}
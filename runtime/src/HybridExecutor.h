@@ -0,0 +1,147 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "UserCore.h"
+#include "DevicePool.h"
+
+namespace fletcher {
+
+/**
+ * Division of work in a hybrid run. Times are in seconds.
+ */
+typedef struct _HybridStats {
+  uint64_t fpga_rows = 0;     // Rows processed by the FPGA
+  uint64_t cpu_rows = 0;      // Rows processed by the CPU threads
+  uint64_t fpga_stolen = 0;   // Ranges of the CPU share processed by the FPGA
+  uint64_t cpu_stolen = 0;    // Ranges of the FPGA share processed by the CPU
+  double fpga = 0.0;          // Time the FPGA was busy
+  double cpu = 0.0;           // Time until the CPU threads finished their last range
+  double total = 0.0;         // Wall-clock time of the whole run
+  double fpga_share = 0.0;    // Fraction of the rows initially given to the FPGA
+} HybridStats;
+
+/**
+ * \class HybridExecutor
+ * \brief Processes the rows of a prepared table on the FPGA and the CPU at
+ * the same time.
+ *
+ * The rows of every chunk are divided into an FPGA share and a CPU share,
+ * sized by the throughput both achieved in previous runs. The FPGA share
+ * is cut into a few large ranges and the CPU share into smaller ones. All
+ * ranges are kept in one queue: the FPGA takes ranges from the front, the
+ * CPU threads from the back. When the FPGA finishes late, the CPU threads
+ * thus steal the tail of its share, and vice versa.
+ */
+class HybridExecutor {
+ public:
+  /// Function returning the UserCore arguments of a range
+  typedef std::function<std::vector<fr_t>(const RowRange &)> arguments_t;
+  /// Function called after the FPGA finished a range, e.g. to collect results
+  typedef std::function<void(UserCore &, const RowRange &)> fpga_done_t;
+  /// Function processing a range on the CPU. Called concurrently, with the index of the thread.
+  typedef std::function<void(size_t, const RowRange &)> cpu_t;
+
+  /**
+   * \param platform    The platform on which the table is prepared.
+   * \param usercore    The UserCore to run.
+   * \param cpu_threads The number of CPU threads, 0 to use all cores.
+   */
+  HybridExecutor(std::shared_ptr<FPGAPlatform> platform, UserCore &usercore, unsigned int cpu_threads = 0);
+
+  /**
+   * \brief Process all rows of the prepared chunks.
+   *
+   * \param cpu_rows_per_range The number of rows per CPU range.
+   * \param arguments          Function returning the UserCore arguments of a range.
+   * \param fpga_done          Optional function called after the FPGA finished a range.
+   * \param cpu                Function processing a range on the CPU.
+   * \return SUCCESS if all rows were processed, FAILURE otherwise
+   *
+   * If fpga_done throws, its range is left to the CPU like the range of a
+   * failed run, and the exception is rethrown once the CPU threads have
+   * finished.
+   */
+  uc_stat run(int64_t cpu_rows_per_range,
+              const arguments_t &arguments,
+              const fpga_done_t &fpga_done,
+              const cpu_t &cpu);
+
+  /**
+   * \brief Set the number of ranges the FPGA share is cut into. More
+   * ranges allow a finer division at the end of a run, but cost more
+   * UserCore invocations.
+   */
+  void set_fpga_ranges(unsigned int ranges);
+
+  /**
+   * \brief Return the fraction of rows that the next run initially gives
+   * to the FPGA.
+   */
+  double fpga_share();
+
+  /**
+   * \brief Return the number of CPU threads.
+   */
+  unsigned int cpu_threads();
+
+  /**
+   * \brief Return the division of work of the last run.
+   */
+  const HybridStats &stats();
+
+ private:
+  std::shared_ptr<FPGAPlatform> _platform;
+  UserCore &usercore;
+  unsigned int _cpu_threads;
+  unsigned int fpga_ranges = 4;
+
+  /// Throughput estimates in rows per second, 0 if unknown
+  double fpga_throughput = 0.0;
+  double cpu_throughput = 0.0;
+
+  HybridStats _stats;
+
+  std::deque<RowRange> ranges;
+  /// Number of ranges at the front that belong to the FPGA share
+  size_t fpga_owned = 0;
+  /// Whether the last range the FPGA took belonged to its share
+  bool fpga_took_owned = false;
+  /// Set while the FPGA may still push back a range it failed on
+  bool fpga_running = false;
+  std::mutex lock;
+  std::condition_variable ranges_cv;
+
+  /**
+   * Take a range from the front for the FPGA, or from the back for the CPU.
+   * The CPU waits for ranges while the FPGA is running.
+   */
+  bool next_range(bool fpga, RowRange &range);
+
+  /// Process ranges on the FPGA until none are left; an exception of fpga_done is stored in done_error
+  uc_stat fpga_work(const arguments_t &arguments, const fpga_done_t &fpga_done, std::exception_ptr &done_error);
+};
+
+}
@@ -0,0 +1,196 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include "logging.h"
+#include "Job.h"
+
+namespace fletcher {
+
+Job::Job(std::shared_ptr<FPGAPlatform> platform, fr_t done_status, fr_t done_status_mask, uint64_t window)
+    : _platform(std::move(platform)),
+      done_status(done_status),
+      done_status_mask(done_status_mask),
+      window(window) {}
+
+bool Job::poll() {
+  if (this->_done) {
+    return true;
+  }
+
+  fr_t status = 0;
+
+  if (!this->_platform->good() || (this->_platform->read_mmio(this->window + UC_REG_STATUS, &status) != OK)) {
+    LOGE("Could not read UserCore status. Job failed.");
+    complete(true);
+  } else if ((status & this->done_status_mask) == this->done_status) {
+    complete(false);
+  }
+
+  return this->_done;
+}
+
+bool Job::done() {
+  return this->_done;
+}
+
+bool Job::failed() {
+  return this->_failed;
+}
+
+uc_stat Job::wait() {
+  // Keep the duration estimate across jobs; a poller is not shared between threads
+  static thread_local Poller poller;
+  return wait(poller);
+}
+
+uc_stat Job::wait(unsigned int poll_interval_usec) {
+  while (!poll()) {
+    if (poll_interval_usec != 0) {
+      usleep(poll_interval_usec);
+    }
+  }
+  return this->_failed ? FAILURE : SUCCESS;
+}
+
+uc_stat Job::wait(Poller &poller) {
+  poller.wait([this]() -> bool { return poll(); });
+  return this->_failed ? FAILURE : SUCCESS;
+}
+
+void Job::on_done(const callback_t &callback) {
+  {
+    std::lock_guard<std::mutex> guard(this->callbacks_lock);
+    if (!this->_done) {
+      this->callbacks.push_back(callback);
+      return;
+    }
+  }
+  callback(*this);
+}
+
+fr_t Job::get_return() {
+  fr_t ret = 0xDEAFBEEF;
+  this->_platform->read_mmio(this->window + UC_REG_RETURN, &ret);
+  return ret;
+}
+
+std::shared_ptr<FPGAPlatform> Job::platform() {
+  return this->_platform;
+}
+
+void Job::complete(bool failed) {
+  std::vector<callback_t> to_call;
+  {
+    std::lock_guard<std::mutex> guard(this->callbacks_lock);
+    if (this->_done) {
+      return;
+    }
+    this->_failed = failed;
+    this->_done = true;
+    to_call.swap(this->callbacks);
+  }
+
+  // Call the callbacks outside of the lock, so they may add new callbacks or
+  // query this job.
+  for (auto const &callback : to_call) {
+    callback(*this);
+  }
+}
+
+/// Return SUCCESS if none of the jobs failed
+static uc_stat all_succeeded(const std::vector<std::shared_ptr<Job>> &jobs) {
+  for (auto const &job : jobs) {
+    if (job->failed()) {
+      return FAILURE;
+    }
+  }
+  return SUCCESS;
+}
+
+uc_stat wait_all(const std::vector<std::shared_ptr<Job>> &jobs) {
+  static thread_local Poller poller;
+  return wait_all(jobs, poller);
+}
+
+uc_stat wait_all(const std::vector<std::shared_ptr<Job>> &jobs, unsigned int poll_interval_usec) {
+  bool all_done;
+  do {
+    all_done = true;
+    for (auto const &job : jobs) {
+      all_done &= job->poll();
+    }
+    if (!all_done && (poll_interval_usec != 0)) {
+      usleep(poll_interval_usec);
+    }
+  } while (!all_done);
+
+  return all_succeeded(jobs);
+}
+
+uc_stat wait_all(const std::vector<std::shared_ptr<Job>> &jobs, Poller &poller) {
+  poller.wait([&jobs]() -> bool {
+    bool all_done = true;
+    for (auto const &job : jobs) {
+      all_done &= job->poll();
+    }
+    return all_done;
+  });
+
+  return all_succeeded(jobs);
+}
+
+size_t wait_any(const std::vector<std::shared_ptr<Job>> &jobs) {
+  static thread_local Poller poller;
+  return wait_any(jobs, poller);
+}
+
+size_t wait_any(const std::vector<std::shared_ptr<Job>> &jobs, unsigned int poll_interval_usec) {
+  if (jobs.empty()) {
+    throw std::runtime_error("Cannot wait for any job of an empty list of jobs.");
+  }
+
+  while (true) {
+    for (size_t j = 0; j < jobs.size(); j++) {
+      if (jobs[j]->poll()) {
+        return j;
+      }
+    }
+    if (poll_interval_usec != 0) {
+      usleep(poll_interval_usec);
+    }
+  }
+}
+
+size_t wait_any(const std::vector<std::shared_ptr<Job>> &jobs, Poller &poller) {
+  if (jobs.empty()) {
+    throw std::runtime_error("Cannot wait for any job of an empty list of jobs.");
+  }
+
+  size_t found = 0;
+  poller.wait([&jobs, &found]() -> bool {
+    for (size_t j = 0; j < jobs.size(); j++) {
+      if (jobs[j]->poll()) {
+        found = j;
+        return true;
+      }
+    }
+    return false;
+  });
+
+  return found;
+}
+
+}
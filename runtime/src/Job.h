@@ -0,0 +1,173 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "Poller.h"
+#include "UserCore.h"
+
+namespace fletcher {
+
+/**
+ * \class Job
+ * \brief A handle to a UserCore run that was started asynchronously.
+ *
+ * A Job does not own a thread. Its completion is detected by polling the
+ * status register from whatever thread calls poll(), wait(), or one of the
+ * wait_all() / wait_any() functions. This allows a single host thread to
+ * keep UserCores on several platforms in flight at the same time.
+ *
+ * Completion callbacks are called exactly once, on the thread that first
+ * observes the job to be done.
+ */
+class Job {
+ public:
+  typedef std::function<void(Job &)> callback_t;
+
+  /**
+   * \param platform         The platform the UserCore runs on.
+   * \param done_status      The status register value of a finished UserCore.
+   * \param done_status_mask The mask applied to the status register before
+   *                         comparing it to done_status.
+   * \param window           The register window of the UserCore.
+   */
+  Job(std::shared_ptr<FPGAPlatform> platform, fr_t done_status, fr_t done_status_mask, uint64_t window = 0);
+
+  /**
+   * \brief Read the status register once, without blocking.
+   * \return true if the job is done (or failed), false otherwise.
+   */
+  bool poll();
+
+  /**
+   * \brief Return true if completion of this job was observed.
+   */
+  bool done();
+
+  /**
+   * \brief Return true if the status of the job could not be read.
+   */
+  bool failed();
+
+  /**
+   * \brief A blocking function that waits for this job to finish, using an
+   * adaptive poller with default settings.
+   *
+   * The poller is kept per calling thread, so its estimate of the job
+   * duration carries over to the next call. To keep separate estimates for
+   * different kinds of jobs, pass a poller, e.g. UserCore::poller().
+   */
+  uc_stat wait();
+
+  /**
+   * \brief A blocking function that waits for this job to finish.
+   *
+   * Polls with an interval of poll_interval_usec microseconds, or at
+   * maximum speed if the interval is 0.
+   */
+  uc_stat wait(unsigned int poll_interval_usec);
+
+  /**
+   * \brief A blocking function that waits for this job to finish, using an
+   * adaptive poller.
+   */
+  uc_stat wait(Poller &poller);
+
+  /**
+   * \brief Add a callback to be called when the job is done.
+   *
+   * If the job is already done, the callback is called immediately.
+   */
+  void on_done(const callback_t &callback);
+
+  /**
+   * \brief Read the return register of the UserCore.
+   */
+  fr_t get_return();
+
+  /**
+   * \brief Return the platform this job runs on.
+   */
+  std::shared_ptr<FPGAPlatform> platform();
+
+ private:
+  std::shared_ptr<FPGAPlatform> _platform;
+
+  fr_t done_status;
+  fr_t done_status_mask;
+  uint64_t window;
+
+  std::atomic<bool> _done{false};
+  std::atomic<bool> _failed{false};
+
+  std::mutex callbacks_lock;
+  std::vector<callback_t> callbacks;
+
+  /// Call all callbacks, if this was not done already.
+  void complete(bool failed);
+};
+
+/**
+ * \brief Wait for all jobs to finish, polling them round robin from the
+ * calling thread with an adaptive poller with default settings. The poller
+ * is kept per calling thread, like that of Job::wait().
+ *
+ * \return SUCCESS if all jobs finished, FAILURE if any of them failed.
+ */
+uc_stat wait_all(const std::vector<std::shared_ptr<Job>> &jobs);
+
+/**
+ * \brief Wait for all jobs to finish, polling them round robin with an
+ * interval of poll_interval_usec microseconds, or at maximum speed if the
+ * interval is 0.
+ */
+uc_stat wait_all(const std::vector<std::shared_ptr<Job>> &jobs, unsigned int poll_interval_usec);
+
+/**
+ * \brief Wait for all jobs to finish, polling them round robin with an
+ * adaptive poller.
+ */
+uc_stat wait_all(const std::vector<std::shared_ptr<Job>> &jobs, Poller &poller);
+
+/**
+ * \brief Wait for any of the jobs to finish, polling them round robin from
+ * the calling thread with an adaptive poller with default settings. The
+ * poller is kept per calling thread, like that of Job::wait().
+ *
+ * \return the index of a finished job in jobs.
+ */
+size_t wait_any(const std::vector<std::shared_ptr<Job>> &jobs);
+
+/**
+ * \brief Wait for any of the jobs to finish, polling them round robin with
+ * an interval of poll_interval_usec microseconds, or at maximum speed if
+ * the interval is 0.
+ */
+size_t wait_any(const std::vector<std::shared_ptr<Job>> &jobs, unsigned int poll_interval_usec);
+
+/**
+ * \brief Wait for any of the jobs to finish, polling them round robin with
+ * an adaptive poller.
+ */
+size_t wait_any(const std::vector<std::shared_ptr<Job>> &jobs, Poller &poller);
+
+}
@@ -0,0 +1,202 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include "Metrics.h"
+
+namespace fletcher {
+
+void Histogram::observe(uint64_t value) {
+  unsigned int b = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  if (b >= METRICS_HISTOGRAM_BUCKETS) {
+    b = METRICS_HISTOGRAM_BUCKETS - 1;
+  }
+  buckets[b].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  _sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+double Histogram::bucket_bound(unsigned int b) {
+  if (b >= METRICS_HISTOGRAM_BUCKETS - 1) {
+    return INFINITY;
+  }
+  return std::ldexp(1.0, b);
+}
+
+void Histogram::reset() {
+  for (auto &b : buckets) {
+    b.store(0, std::memory_order_relaxed);
+  }
+  _count.store(0, std::memory_order_relaxed);
+  _sum.store(0, std::memory_order_relaxed);
+}
+
+Metrics &Metrics::global() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::Family &Metrics::family(const std::string &name, const std::string &help, bool is_histogram) {
+  auto it = families.find(name);
+  if (it == families.end()) {
+    Family &f = families[name];
+    f.help = help;
+    f.is_histogram = is_histogram;
+    return f;
+  }
+  if (it->second.is_histogram != is_histogram) {
+    throw std::runtime_error("Metric " + name + " was already registered as another type.");
+  }
+  return it->second;
+}
+
+Counter &Metrics::counter(const std::string &name, const std::string &help, const std::string &labels) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto &series = family(name, help, false).counters[labels];
+  if (!series) {
+    series.reset(new Counter);
+  }
+  return *series;
+}
+
+Histogram &Metrics::histogram(const std::string &name, const std::string &help, const std::string &labels) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto &series = family(name, help, true).histograms[labels];
+  if (!series) {
+    series.reset(new Histogram);
+  }
+  return *series;
+}
+
+static std::string json_escape(const std::string &str) {
+  std::string escaped;
+  for (char c : str) {
+    if ((c == '"') || (c == '\\')) {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+/// Return labels in Prometheus notation, with an extra label appended
+static std::string prometheus_labels(const std::string &labels, const std::string &extra = "") {
+  std::string all = labels;
+  if (!extra.empty()) {
+    all += (all.empty() ? "" : ",") + extra;
+  }
+  return all.empty() ? "" : "{" + all + "}";
+}
+
+/// Return the inclusive upper bound of integer values in bucket b
+static std::string bucket_le(unsigned int b) {
+  double bound = Histogram::bucket_bound(b);
+  if (std::isinf(bound)) {
+    return "+Inf";
+  }
+  return std::to_string(static_cast<uint64_t>(bound) - 1);
+}
+
+std::string Metrics::to_json() {
+  std::lock_guard<std::mutex> guard(lock);
+  std::stringstream str;
+
+  str << "{";
+  bool first_family = true;
+  for (const auto &f : families) {
+    str << (first_family ? "" : ",") << "\"" << json_escape(f.first) << "\":{";
+    str << "\"type\":\"" << (f.second.is_histogram ? "histogram" : "counter") << "\",";
+    str << "\"help\":\"" << json_escape(f.second.help) << "\",";
+    str << "\"series\":[";
+    first_family = false;
+
+    bool first_series = true;
+    for (const auto &c : f.second.counters) {
+      str << (first_series ? "" : ",") << "{\"labels\":\"" << json_escape(c.first) << "\",\"value\":"
+          << c.second->get() << "}";
+      first_series = false;
+    }
+    for (const auto &h : f.second.histograms) {
+      str << (first_series ? "" : ",") << "{\"labels\":\"" << json_escape(h.first) << "\",\"count\":"
+          << h.second->count() << ",\"sum\":" << h.second->sum() << ",\"buckets\":{";
+      first_series = false;
+
+      bool first_bucket = true;
+      for (unsigned int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+        if (h.second->bucket(b) > 0) {
+          str << (first_bucket ? "" : ",") << "\"" << bucket_le(b) << "\":" << h.second->bucket(b);
+          first_bucket = false;
+        }
+      }
+      str << "}}";
+    }
+    str << "]}";
+  }
+  str << "}";
+
+  return str.str();
+}
+
+std::string Metrics::to_prometheus() {
+  std::lock_guard<std::mutex> guard(lock);
+  std::stringstream str;
+
+  for (const auto &f : families) {
+    const std::string &name = f.first;
+    str << "# HELP " << name << " " << f.second.help << "\n";
+    str << "# TYPE " << name << " " << (f.second.is_histogram ? "histogram" : "counter") << "\n";
+
+    for (const auto &c : f.second.counters) {
+      str << name << prometheus_labels(c.first) << " " << c.second->get() << "\n";
+    }
+
+    for (const auto &h : f.second.histograms) {
+      // Buckets are cumulative, and end at the highest one in use
+      unsigned int last = 0;
+      for (unsigned int b = 0; b < METRICS_HISTOGRAM_BUCKETS - 1; b++) {
+        if (h.second->bucket(b) > 0) {
+          last = b;
+        }
+      }
+      uint64_t cumulative = 0;
+      for (unsigned int b = 0; b <= last; b++) {
+        cumulative += h.second->bucket(b);
+        str << name << "_bucket" << prometheus_labels(h.first, "le=\"" + bucket_le(b) + "\"") << " " << cumulative
+            << "\n";
+      }
+      str << name << "_bucket" << prometheus_labels(h.first, "le=\"+Inf\"") << " " << h.second->count() << "\n";
+      str << name << "_sum" << prometheus_labels(h.first) << " " << h.second->sum() << "\n";
+      str << name << "_count" << prometheus_labels(h.first) << " " << h.second->count() << "\n";
+    }
+  }
+
+  return str.str();
+}
+
+void Metrics::reset() {
+  std::lock_guard<std::mutex> guard(lock);
+  for (auto &f : families) {
+    for (auto &c : f.second.counters) {
+      c.second->reset();
+    }
+    for (auto &h : f.second.histograms) {
+      h.second->reset();
+    }
+  }
+}
+
+}
@@ -0,0 +1,151 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/// The number of buckets of a Histogram
+#define METRICS_HISTOGRAM_BUCKETS 64
+
+namespace fletcher {
+
+/**
+ * \class Counter
+ * \brief A monotonically increasing count. Lock-free.
+ */
+class Counter {
+ public:
+  void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+  void reset() { value.store(0, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value{0};
+};
+
+/**
+ * \class Histogram
+ * \brief Distribution of observed values over power-of-two buckets.
+ * Lock-free.
+ *
+ * Bucket b counts the values v with 2^(b-1) <= v < 2^b; bucket 0 counts
+ * zeroes.
+ */
+class Histogram {
+ public:
+  void observe(uint64_t value);
+
+  uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+
+  uint64_t sum() const { return _sum.load(std::memory_order_relaxed); }
+
+  uint64_t bucket(unsigned int b) const { return buckets[b].load(std::memory_order_relaxed); }
+
+  /// Return the exclusive upper bound of the values counted by bucket b
+  static double bucket_bound(unsigned int b);
+
+  void reset();
+
+ private:
+  std::atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKETS] = {};
+  std::atomic<uint64_t> _count{0};
+  std::atomic<uint64_t> _sum{0};
+};
+
+/**
+ * \class ScopedTimer
+ * \brief Observes the number of nanoseconds it was alive in a Histogram.
+ */
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram &histogram)
+      : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    histogram.observe(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count()));
+  }
+
+ private:
+  Histogram &histogram;
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * \class Metrics
+ * \brief Registry of named counters and histograms.
+ *
+ * A metric is identified by its name and an optional set of labels in
+ * Prometheus notation, e.g. queue="0". Looking up a metric takes a lock,
+ * so hot paths should keep the returned reference, e.g. in a static local;
+ * updating it does not. Metrics live as long as the registry.
+ */
+class Metrics {
+ public:
+  /**
+   * \brief Return the registry used by the runtime.
+   */
+  static Metrics &global();
+
+  /**
+   * \brief Return the counter with some name and labels, creating it if
+   * it does not exist yet.
+   */
+  Counter &counter(const std::string &name, const std::string &help, const std::string &labels = "");
+
+  /**
+   * \brief Return the histogram with some name and labels, creating it if
+   * it does not exist yet.
+   */
+  Histogram &histogram(const std::string &name, const std::string &help, const std::string &labels = "");
+
+  /**
+   * \brief Export all metrics as a JSON object.
+   */
+  std::string to_json();
+
+  /**
+   * \brief Export all metrics in the Prometheus text exposition format.
+   */
+  std::string to_prometheus();
+
+  /**
+   * \brief Reset all metrics to zero.
+   */
+  void reset();
+
+ private:
+  typedef struct _Family {
+    std::string help;
+    bool is_histogram;
+    std::map<std::string, std::unique_ptr<Counter>> counters;
+    std::map<std::string, std::unique_ptr<Histogram>> histograms;
+  } Family;
+
+  std::mutex lock;
+  std::map<std::string, Family> families;
+
+  Family &family(const std::string &name, const std::string &help, bool is_histogram);
+};
+
+}
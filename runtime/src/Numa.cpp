@@ -0,0 +1,181 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "common.h"
+#include "logging.h"
+#include "Numa.h"
+
+// From linux/mempolicy.h, which not every toolchain ships
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+namespace fletcher {
+
+int numa_node_from_sysfs(const std::string &path) {
+  std::ifstream file(path);
+  int node = NUMA_NODE_NONE;
+
+  // The kernel writes -1 if the firmware did not report the node
+  if (!(file >> node) || (node < 0)) {
+    return NUMA_NODE_NONE;
+  }
+
+  return node;
+}
+
+int numa_node_of_pci_device(const std::string &address) {
+  int node = numa_node_from_sysfs("/sys/bus/pci/devices/" + address + "/numa_node");
+  LOGD("[NUMA] PCI device " << address << " is attached to node " << node);
+  return node;
+}
+
+std::vector<int> numa_node_cpus(int node) {
+  std::vector<int> cpus;
+  if (node < 0) {
+    return cpus;
+  }
+
+  // A list of ranges, e.g. 0-17,36-53
+  std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+  std::string range;
+  while (std::getline(file, range, ',')) {
+    int first, last;
+    char dash;
+    std::istringstream str(range);
+    if (!(str >> first)) {
+      continue;
+    }
+    last = (str >> dash >> last) ? last : first;
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+
+  return cpus;
+}
+
+int numa_pin_thread(int node) {
+  if (node < 0) {
+    return OK;
+  }
+
+  auto cpus = numa_node_cpus(node);
+  if (cpus.empty()) {
+    LOGD("[NUMA] Node " << node << " has no CPUs, thread is not pinned.");
+    return ERROR;
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc != 0) {
+    LOGD("[NUMA] Could not pin thread to node " << node << ": " << strerror(rc));
+    return ERROR;
+  }
+
+  return OK;
+}
+
+int numa_bind(void *address, size_t length, int node) {
+  if (node < 0) {
+    return OK;
+  }
+
+  const size_t bits = sizeof(unsigned long) * CHAR_BIT;
+  std::vector<unsigned long> mask(static_cast<size_t>(node) / bits + 1, 0);
+  mask[static_cast<size_t>(node) / bits] |= 1UL << (static_cast<size_t>(node) % bits);
+
+  // Preferred rather than bound, such that allocation does not fail when the node is full
+  if (syscall(SYS_mbind, address, length, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1, 0) != 0) {
+    LOGD("[NUMA] Could not bind " << length << " bytes to node " << node << ": " << strerror(errno));
+    return ERROR;
+  }
+
+  return OK;
+}
+
+size_t numa_migrate(const void *address, size_t length, int node) {
+  if ((node < 0) || (length == 0)) {
+    return 0;
+  }
+
+  auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t first = reinterpret_cast<uintptr_t>(address) & ~(page_size - 1);
+  uintptr_t last = (reinterpret_cast<uintptr_t>(address) + length - 1) & ~(page_size - 1);
+
+  std::vector<void *> pages;
+  for (uintptr_t page = first; page <= last; page += page_size) {
+    pages.push_back(reinterpret_cast<void *>(page));
+  }
+
+  // Find the pages that live elsewhere; pages that were never touched have no node yet
+  std::vector<int> status(pages.size());
+  if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0) {
+    LOGD("[NUMA] Could not query the nodes of " << pages.size() << " pages: " << strerror(errno));
+    return 0;
+  }
+
+  std::vector<void *> remote;
+  for (size_t i = 0; i < pages.size(); i++) {
+    if ((status[i] >= 0) && (status[i] != node)) {
+      remote.push_back(pages[i]);
+    }
+  }
+
+  if (remote.empty()) {
+    return 0;
+  }
+
+  std::vector<int> nodes(remote.size(), node);
+  status.resize(remote.size());
+  if (syscall(SYS_move_pages, 0, remote.size(), remote.data(), nodes.data(), status.data(), MPOL_MF_MOVE) < 0) {
+    LOGD("[NUMA] Could not move " << remote.size() << " pages to node " << node << ": " << strerror(errno));
+    return 0;
+  }
+
+  size_t moved = 0;
+  for (auto s : status) {
+    if (s == node) {
+      moved++;
+    }
+  }
+
+  LOGD("[NUMA] Moved " << moved << " of " << pages.size() << " pages to node " << node);
+
+  return moved;
+}
+
+}
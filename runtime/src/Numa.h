@@ -0,0 +1,77 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// The NUMA node of memory or devices that are not attached to a specific node
+#define NUMA_NODE_NONE -1
+
+namespace fletcher {
+
+/*
+ * On hosts with several sockets, an FPGA is attached to the PCIe root of
+ * one of them. Host buffers on the other sockets, and threads copying or
+ * polling from there, cross the socket interconnect for every transfer.
+ * These functions find the node of a device and keep memory and threads
+ * on it. They use sysfs and raw system calls, so libnuma is not needed,
+ * and they do nothing for NUMA_NODE_NONE.
+ */
+
+/**
+ * \brief Read a NUMA node from a sysfs numa_node file.
+ *
+ * \return the node, or NUMA_NODE_NONE if the file does not exist or the
+ * kernel does not know the node.
+ */
+int numa_node_from_sysfs(const std::string &path);
+
+/**
+ * \brief Return the NUMA node of a PCI device.
+ *
+ * \param address The address of the device, e.g. 0000:00:1d.0
+ */
+int numa_node_of_pci_device(const std::string &address);
+
+/**
+ * \brief Return the CPUs of a NUMA node, or none if it is unknown.
+ */
+std::vector<int> numa_node_cpus(int node);
+
+/**
+ * \brief Restrict the calling thread to the CPUs of a NUMA node.
+ */
+int numa_pin_thread(int node);
+
+/**
+ * \brief Let pages of a mapping that are not yet faulted in be allocated
+ * on a NUMA node, falling back to other nodes when it is full.
+ *
+ * The address must be page-aligned.
+ */
+int numa_bind(void *address, size_t length, int node);
+
+/**
+ * \brief Move the pages of a range of memory to a NUMA node.
+ *
+ * Pages that are partly in the range are moved as a whole.
+ *
+ * \return the number of pages that were moved
+ */
+size_t numa_migrate(const void *address, size_t length, int node);
+
+}
@@ -0,0 +1,371 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "logging.h"
+#include "Metrics.h"
+#include "OutputColumn.h"
+
+namespace fletcher {
+
+static Counter &readback_bytes = Metrics::global().counter("fletcher_readback_bytes_total",
+                                                           "Number of bytes read back from the device.");
+static Counter &overflows = Metrics::global().counter("fletcher_output_overflows_total",
+                                                      "Number of runs of which the output buffers were too small.");
+
+OutputColumn::OutputColumn(std::shared_ptr<FPGAPlatform> platform,
+                           std::shared_ptr<arrow::Field> field,
+                           int64_t length,
+                           int64_t values,
+                           arrow::MemoryPool *pool)
+    : _platform(std::move(platform)), field(std::move(field)), _length(length), pool(pool) {
+  if (length < 0) {
+    throw std::runtime_error("Output column " + this->field->name() + " cannot have a negative length.");
+  }
+
+  plan(this->field, length, values < 0 ? length : values);
+  allocate();
+
+  LOGD("[OutputColumn] Column " << this->field->name() << " of " << length << " rows in " << this->slots.size()
+                                << " buffers.");
+}
+
+OutputColumn::~OutputColumn() {
+  if (!this->finalized) {
+    this->_platform->release_buffers(this->dest_buffers);
+  }
+}
+
+const std::vector<BufConfig> &OutputColumn::buffers() {
+  return this->dest_buffers;
+}
+
+std::vector<fr_t> OutputColumn::capacities() {
+  std::vector<fr_t> result;
+  for (auto const &buf : this->dest_buffers) {
+    result.push_back(static_cast<fr_t>(buf.capacity));
+  }
+  return result;
+}
+
+int64_t OutputColumn::length() {
+  return this->_length;
+}
+
+bool OutputColumn::overflowed() {
+  if (this->finalized) {
+    throw std::runtime_error("Output column " + this->field->name() + " was finalized.");
+  }
+
+  size_t next = 0;
+  return check(this->field, this->_length, next);
+}
+
+void OutputColumn::grow(double slack) {
+  if (this->finalized) {
+    throw std::runtime_error("Output column " + this->field->name() + " was finalized.");
+  }
+
+  bool grown = false;
+  for (auto &slot : this->slots) {
+    if (slot.needed > slot.rows) {
+      LOGD("[OutputColumn] Buffer " << slot.name << " needs " << slot.needed << " elements, has " << slot.rows);
+      slot.rows = static_cast<int64_t>(std::ceil(slot.needed * std::max(slack, 1.0)));
+      slot.host.reset();
+      grown = true;
+    }
+    slot.needed = 0;
+  }
+
+  if (grown) {
+    allocate();
+  }
+}
+
+uc_stat OutputColumn::run(UserCore &usercore,
+                          const std::vector<BufConfig> &inputs,
+                          const std::function<std::vector<fr_t>(OutputColumn &)> &arguments,
+                          int max_attempts) {
+  for (int attempt = 1; attempt <= max_attempts; attempt++) {
+    std::vector<BufConfig> all(inputs);
+    all.insert(all.end(), this->dest_buffers.begin(), this->dest_buffers.end());
+
+    usercore.reset();
+    if (usercore.activate_buffers(all) != SUCCESS || usercore.set_arguments(arguments(*this)) != SUCCESS) {
+      return FAILURE;
+    }
+    usercore.start();
+    if (usercore.wait_for_finish() != SUCCESS) {
+      return FAILURE;
+    }
+
+    if (!overflowed()) {
+      return SUCCESS;
+    }
+
+    overflows.add(1);
+    LOGI("[OutputColumn] Buffers of " << this->field->name() << " overflowed in attempt " << attempt << " of "
+                                      << max_attempts << ".");
+
+    if (attempt < max_attempts) {
+      grow();
+    }
+  }
+
+  LOGE("[OutputColumn] Buffers of " << this->field->name() << " still overflowed after " << max_attempts
+                                    << " attempts.");
+  return FAILURE;
+}
+
+std::shared_ptr<arrow::Array> OutputColumn::finalize() {
+  if (this->finalized) {
+    throw std::runtime_error("Output column " + this->field->name() + " was finalized.");
+  }
+
+  size_t next = 0;
+  auto data = read(this->field, this->_length, next);
+
+  this->_platform->release_buffers(this->dest_buffers);
+  this->dest_buffers.clear();
+  this->slots.clear();
+  this->finalized = true;
+
+  return arrow::MakeArray(data);
+}
+
+/*
+ * Slots are planned in the same order as append_chunk_buffer_config
+ * produces buffers: the validity bitmap of nullable fields, then the
+ * offsets of lists, strings and binaries, then the data. Children of lists
+ * and structs follow their parent.
+ */
+void OutputColumn::plan(const std::shared_ptr<arrow::Field> &field, int64_t rows, int64_t values) {
+  auto type = field->type();
+
+  if (field->nullable()) {
+    this->slots.push_back({"vbmp " + field->name(), 1, false, rows, 0, nullptr});
+  }
+
+  switch (type->id()) {
+    case arrow::Type::STRING:
+    case arrow::Type::BINARY:
+      this->slots.push_back({"offs " + field->name(), 32, true, rows, 0, nullptr});
+      this->slots.push_back({"data " + field->name(), 8, false, values, 0, nullptr});
+      break;
+
+    case arrow::Type::LIST:
+      this->slots.push_back({"offs " + field->name(), 32, true, rows, 0, nullptr});
+      plan(type->child(0), values, values);
+      break;
+
+    case arrow::Type::STRUCT:
+      for (int c = 0; c < type->num_children(); c++) {
+        plan(type->child(c), rows, values);
+      }
+      break;
+
+    default: {
+      auto fixed_width = std::dynamic_pointer_cast<arrow::FixedWidthType>(type);
+      if (!fixed_width) {
+        throw std::runtime_error("Cannot write field " + field->name() + " of type " + type->ToString() + ".");
+      }
+      this->slots.push_back({"data " + field->name(), fixed_width->bit_width(), false, rows, 0, nullptr});
+      break;
+    }
+  }
+}
+
+void OutputColumn::allocate() {
+  std::vector<BufConfig> source_buffers;
+
+  for (auto &slot : this->slots) {
+    int64_t capacity = bytes(slot, slot.rows);
+
+    // Nothing is written before the UserCore runs, so the memory is left uninitialized. Empty buffers still
+    // get memory, such that no two buffers share an address.
+    if (!slot.host && !arrow::AllocateResizableBuffer(this->pool, std::max<int64_t>(capacity, 1), &slot.host).ok()) {
+      throw std::runtime_error("Could not allocate " + std::to_string(capacity) + " bytes for " + slot.name + ".");
+    }
+
+    // With a size of zero, platforms with on-board memory allocate the capacity without copying anything
+    BufConfig source;
+    source.name = slot.name;
+    source.address = reinterpret_cast<fa_t>(slot.host->mutable_data());
+    source.size = 0;
+    source.capacity = capacity;
+    source.owner = slot.host;
+    source_buffers.push_back(source);
+  }
+
+  this->_platform->release_buffers(this->dest_buffers);
+  this->dest_buffers.clear();
+  this->_platform->stage_buffers(source_buffers, this->dest_buffers);
+}
+
+bool OutputColumn::check(const std::shared_ptr<arrow::Field> &field, int64_t rows, size_t &next) {
+  auto type = field->type();
+  bool overflow = false;
+
+  // Mark a slot that cannot hold some number of elements
+  auto need = [&](size_t slot, int64_t elements) -> bool {
+    if (elements <= this->slots[slot].rows) {
+      return false;
+    }
+    this->slots[slot].needed = std::max(this->slots[slot].needed, elements);
+    return true;
+  };
+
+  if (field->nullable()) {
+    overflow |= need(next++, rows);
+  }
+
+  switch (type->id()) {
+    case arrow::Type::STRING:
+    case arrow::Type::BINARY:
+    case arrow::Type::LIST: {
+      size_t offsets = next++;
+
+      // The offsets of a row the buffer cannot hold were never written
+      int64_t values = -1;
+      if (rows >= 0) {
+        if (need(offsets, rows)) {
+          overflow = true;
+        } else {
+          values = read_offset(offsets, rows);
+        }
+      }
+
+      if (type->id() == arrow::Type::LIST) {
+        overflow |= check(type->child(0), values, next);
+      } else {
+        overflow |= need(next++, values);
+      }
+      break;
+    }
+
+    case arrow::Type::STRUCT:
+      for (int c = 0; c < type->num_children(); c++) {
+        overflow |= check(type->child(c), rows, next);
+      }
+      break;
+
+    default:
+      overflow |= need(next++, rows);
+      break;
+  }
+
+  return overflow;
+}
+
+std::shared_ptr<arrow::ArrayData> OutputColumn::read(const std::shared_ptr<arrow::Field> &field,
+                                                     int64_t rows,
+                                                     size_t &next) {
+  auto type = field->type();
+
+  std::vector<std::shared_ptr<arrow::Buffer>> buffers;
+  std::vector<std::shared_ptr<arrow::ArrayData>> children;
+
+  // Hand the host buffer of the next slot to the array, holding size bytes
+  auto take = [&](int64_t size) -> std::shared_ptr<arrow::Buffer> {
+    size_t i = next++;
+    Slot &slot = this->slots[i];
+    const BufConfig &device = this->dest_buffers[i];
+
+    if (size > device.capacity) {
+      throw std::runtime_error("Buffer " + slot.name + " holds " + std::to_string(size)
+                                   + " bytes, exceeding its capacity of " + std::to_string(device.capacity)
+                                   + " bytes.");
+    }
+
+    // The UserCore wrote the host buffer directly if the platform did not organize it elsewhere
+    if ((size > 0) && (device.address != reinterpret_cast<fa_t>(slot.host->data()))) {
+      readback_bytes.add(this->_platform->copy_from_device(device.address, slot.host->mutable_data(),
+                                                           static_cast<uint64_t>(size)));
+    }
+
+    if (!slot.host->Resize(size).ok()) {
+      throw std::runtime_error("Could not shrink " + slot.name + " to " + std::to_string(size) + " bytes.");
+    }
+
+    return slot.host;
+  };
+
+  int64_t null_count = 0;
+  std::shared_ptr<arrow::Buffer> validity;
+  if (field->nullable()) {
+    validity = take(arrow::BitUtil::BytesForBits(rows));
+    null_count = arrow::kUnknownNullCount;
+  }
+  buffers.push_back(validity);
+
+  switch (type->id()) {
+    case arrow::Type::STRING:
+    case arrow::Type::BINARY:
+    case arrow::Type::LIST: {
+      auto offsets = take((rows + 1) * static_cast<int64_t>(sizeof(int32_t)));
+      buffers.push_back(offsets);
+      int64_t num_values = reinterpret_cast<const int32_t *>(offsets->data())[rows];
+
+      if (type->id() == arrow::Type::LIST) {
+        children.push_back(read(type->child(0), num_values, next));
+      } else {
+        buffers.push_back(take(num_values));
+      }
+      break;
+    }
+
+    case arrow::Type::STRUCT:
+      for (int c = 0; c < type->num_children(); c++) {
+        children.push_back(read(type->child(c), rows, next));
+      }
+      break;
+
+    default: {
+      auto fixed_width = std::dynamic_pointer_cast<arrow::FixedWidthType>(type);
+      buffers.push_back(take(arrow::BitUtil::BytesForBits(rows * fixed_width->bit_width())));
+      break;
+    }
+  }
+
+  auto data = std::make_shared<arrow::ArrayData>(type, rows, buffers, null_count);
+  data->child_data = children;
+
+  return data;
+}
+
+int64_t OutputColumn::read_offset(size_t slot, int64_t row) {
+  int32_t offset = 0;
+  this->_platform->copy_from_device(this->dest_buffers[slot].address + row * sizeof(int32_t),
+                                    reinterpret_cast<uint8_t *>(&offset), sizeof(int32_t));
+
+  // Offsets start at zero and cannot decrease, so no row can end before zero
+  if (offset < 0) {
+    throw std::runtime_error("Buffer " + this->slots[slot].name + " holds a negative offset at row "
+                                 + std::to_string(row) + ".");
+  }
+
+  return offset;
+}
+
+int64_t OutputColumn::bytes(const Slot &slot, int64_t rows) {
+  if (slot.offsets) {
+    return (rows + 1) * static_cast<int64_t>(sizeof(int32_t));
+  }
+  return arrow::BitUtil::BytesForBits(rows * slot.bit_width);
+}
+
+}
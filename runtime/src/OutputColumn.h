@@ -0,0 +1,175 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "UserCore.h"
+
+#define OUTPUT_DEFAULT_SLACK    1.25
+#define OUTPUT_DEFAULT_ATTEMPTS 3
+
+namespace fletcher {
+
+/**
+ * \class OutputColumn
+ * \brief Buffers for a column that is written by a UserCore, i.e. a field
+ * with fletcher_mode "write", and their conversion to an Arrow array.
+ *
+ * The buffers are allocated for a known number of rows. Validity bitmaps,
+ * offsets and fixed-width values follow from that exactly, while the
+ * number of values of strings, binaries and lists is estimated. The
+ * buffers are not initialized: the UserCore signals completion through
+ * its status register, so no sentinel values are needed.
+ *
+ * The UserCore must not write beyond the capacity of a buffer, which it
+ * can be given through its arguments, but must still write the offset
+ * that a complete result would end at. After a run, overflowed() compares
+ * the last offsets with the capacities, after which grow() reallocates
+ * the buffers that were too small and the UserCore can be run again.
+ * run() does all of this.
+ *
+ * On platforms where the FPGA accesses host memory, the UserCore writes
+ * the host buffers directly and finalize() wraps them without copies.
+ * Elsewhere, the buffers are allocated in on-board memory and read back
+ * by finalize().
+ */
+class OutputColumn {
+ public:
+  /**
+   * \param platform      The platform of the UserCore.
+   * \param field         The field of the column.
+   * \param length        The number of rows the UserCore writes.
+   * \param values        The estimated total number of values, e.g.
+   *                      characters, of strings, binaries and lists, or
+   *                      -1 for one value per row.
+   * \param pool          The MemoryPool to allocate host buffers from.
+   */
+  OutputColumn(std::shared_ptr<FPGAPlatform> platform,
+               std::shared_ptr<arrow::Field> field,
+               int64_t length,
+               int64_t values = -1,
+               arrow::MemoryPool *pool = arrow::default_memory_pool());
+
+  ~OutputColumn();
+
+  /**
+   * \brief Return the buffers to activate for the UserCore, in the same
+   * order as the buffers of a prepared chunk of the field.
+   */
+  const std::vector<BufConfig> &buffers();
+
+  /**
+   * \brief Return the capacities of the buffers in bytes, in the same
+   * order as buffers().
+   */
+  std::vector<fr_t> capacities();
+
+  /**
+   * \brief Return the number of rows of the column.
+   */
+  int64_t length();
+
+  /**
+   * \brief Check whether the UserCore needed more values than the buffers
+   * hold.
+   *
+   * Must be called after the UserCore finished. Throws if the UserCore
+   * wrote offsets that cannot be right.
+   */
+  bool overflowed();
+
+  /**
+   * \brief Reallocate the buffers found too small by overflowed().
+   *
+   * Their capacity becomes the number of values the UserCore needed times
+   * slack. The contents of all buffers are discarded.
+   */
+  void grow(double slack = OUTPUT_DEFAULT_SLACK);
+
+  /**
+   * \brief Run a UserCore that writes this column, until its buffers are
+   * large enough.
+   *
+   * \param usercore     The UserCore.
+   * \param inputs       Organized buffers of the UserCore that precede
+   *                     those of this column, e.g. of its input columns.
+   * \param arguments    Function returning the arguments of the UserCore,
+   *                     e.g. including capacities().
+   * \param max_attempts The number of runs before giving up.
+   * \return SUCCESS if the UserCore finished without overflow
+   */
+  uc_stat run(UserCore &usercore,
+              const std::vector<BufConfig> &inputs,
+              const std::function<std::vector<fr_t>(OutputColumn &)> &arguments,
+              int max_attempts = OUTPUT_DEFAULT_ATTEMPTS);
+
+  /**
+   * \brief Convert the buffers to an Arrow array of length rows.
+   *
+   * The host buffers are shrunk to the size of their contents and handed
+   * to the array, after which the column cannot be used anymore.
+   */
+  std::shared_ptr<arrow::Array> finalize();
+
+ private:
+  /// A buffer of the column
+  typedef struct _Slot {
+    std::string name;
+    int64_t bit_width;  // of every element
+    bool offsets;       // holds one more element than rows
+    int64_t rows;       // number of elements it has capacity for
+    int64_t needed;     // number of elements the UserCore needed
+    std::shared_ptr<arrow::ResizableBuffer> host;
+  } Slot;
+
+  std::shared_ptr<FPGAPlatform> _platform;
+  std::shared_ptr<arrow::Field> field;
+  int64_t _length;
+  arrow::MemoryPool *pool;
+
+  std::vector<Slot> slots;
+  std::vector<BufConfig> dest_buffers;
+
+  bool finalized = false;
+
+  /// Add the slots of a field of some number of rows
+  void plan(const std::shared_ptr<arrow::Field> &field, int64_t rows, int64_t values);
+
+  /// Allocate host buffers of every slot that has none, and organize all of them
+  void allocate();
+
+  /// Check a field of some number of rows, or of an unknown number if rows < 0
+  bool check(const std::shared_ptr<arrow::Field> &field, int64_t rows, size_t &next);
+
+  /// Read a field of some number of rows into an ArrayData
+  std::shared_ptr<arrow::ArrayData> read(const std::shared_ptr<arrow::Field> &field, int64_t rows, size_t &next);
+
+  /// Read the offset of a row from an offsets slot
+  int64_t read_offset(size_t slot, int64_t row);
+
+  /// Return the capacity of a slot in bytes
+  static int64_t bytes(const Slot &slot, int64_t rows);
+};
+
+}
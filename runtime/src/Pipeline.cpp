@@ -0,0 +1,150 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <future>
+
+#include "logging.h"
+#include "Pipeline.h"
+
+namespace fletcher {
+
+typedef std::chrono::steady_clock pipeline_clock;
+
+static inline double seconds_since(pipeline_clock::time_point start) {
+  return std::chrono::duration<double>(pipeline_clock::now() - start).count();
+}
+
+Pipeline::Pipeline(std::shared_ptr<FPGAPlatform> platform, UserCore &usercore)
+    : _platform(std::move(platform)), usercore(usercore) {}
+
+uc_stat Pipeline::run(const std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+                      const arguments_t &arguments,
+                      const done_t &done) {
+  this->_stats = PipelineStats();
+
+  if (batches.empty()) {
+    return SUCCESS;
+  }
+
+  auto run_start = pipeline_clock::now();
+
+  // Destination buffers of the current and the next batch
+  std::vector<BufConfig> staged[2];
+
+  // Stage a batch, returning the time it took
+  auto stage = [this, &batches, &staged](size_t b) -> double {
+    auto start = pipeline_clock::now();
+    this->_stats.bytes += this->_platform->stage_recordbatch(batches[b], staged[b % 2]);
+    return seconds_since(start);
+  };
+
+  // The first batch can't overlap with anything
+  this->_stats.copy += stage(0);
+
+  for (size_t b = 0; b < batches.size(); b++) {
+    unsigned int current = b % 2;
+
+    // Stage the next batch while the UserCore works on this one
+    std::future<double> next;
+    if (b + 1 < batches.size()) {
+      next = std::async(std::launch::async, stage, b + 1);
+    }
+
+    auto compute_start = pipeline_clock::now();
+
+    uc_stat stat = FAILURE;
+    try {
+      this->usercore.reset();
+
+      // Don't start the UserCore on buffers or arguments that were not written, but still clean up below
+      if (this->usercore.activate_buffers(staged[current]) == SUCCESS
+          && this->usercore.set_arguments(arguments(b, batches[b])) == SUCCESS) {
+        this->usercore.start();
+        stat = this->usercore.wait_for_finish();
+      }
+
+      this->_stats.compute += seconds_since(compute_start);
+
+      if (stat == SUCCESS && done) {
+        done(b, batches[b]);
+      }
+    } catch (...) {
+      // Release both batches, after the next one was staged completely
+      this->_platform->release_buffers(staged[current]);
+      if (next.valid()) {
+        try {
+          next.get();
+          this->_platform->release_buffers(staged[1 - current]);
+        } catch (...) {
+          // The first exception is the one to report
+        }
+      }
+      throw;
+    }
+
+    // The device memory of this batch may now be reused
+    this->_platform->release_buffers(staged[current]);
+    staged[current].clear();
+
+    // The next batch must be staged completely before it can be swapped in.
+    // get() rethrows any exception that occurred while staging.
+    if (next.valid()) {
+      this->_stats.copy += next.get();
+    }
+
+    if (stat != SUCCESS) {
+      this->_platform->release_buffers(staged[1 - current]);
+      LOGE("[Pipeline] UserCore failed on batch " << b << ".");
+      this->_stats.total = seconds_since(run_start);
+      return FAILURE;
+    }
+
+    this->_stats.batches++;
+  }
+
+  this->_stats.total = seconds_since(run_start);
+
+  LOGD("[Pipeline] " << this->_stats.batches << " batches, " << this->_stats.bytes << " bytes. Copy: "
+                     << this->_stats.copy << " s, compute: " << this->_stats.compute << " s, total: "
+                     << this->_stats.total << " s.");
+
+  return SUCCESS;
+}
+
+const PipelineStats &Pipeline::stats() {
+  return this->_stats;
+}
+
+std::vector<std::shared_ptr<arrow::RecordBatch>> Pipeline::split(const std::shared_ptr<arrow::Table> &table,
+                                                                 int64_t rows_per_batch) {
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+
+  arrow::TableBatchReader reader(*table);
+  reader.set_chunksize(rows_per_batch);
+
+  std::shared_ptr<arrow::RecordBatch> batch;
+  do {
+    if (!reader.ReadNext(&batch).ok()) {
+      throw std::runtime_error("Could not split table into batches.");
+    }
+    if (batch) {
+      batches.push_back(batch);
+    }
+  } while (batch);
+
+  return batches;
+}
+
+}
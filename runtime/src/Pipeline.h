@@ -0,0 +1,97 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "UserCore.h"
+
+namespace fletcher {
+
+/**
+ * Timing of a pipelined run. All times are in seconds.
+ */
+typedef struct _PipelineStats {
+  uint64_t batches = 0;   // Number of batches processed
+  uint64_t bytes = 0;     // Number of bytes staged
+  double copy = 0.0;      // Total time spent staging batches
+  double compute = 0.0;   // Total time spent running the UserCore
+  double total = 0.0;     // Wall-clock time of the whole run
+} PipelineStats;
+
+/**
+ * \class Pipeline
+ * \brief Double-buffered copy/compute pipeline.
+ *
+ * A table is processed as a sequence of row-range batches. While the
+ * UserCore processes batch N from one set of device buffers, batch N+1 is
+ * staged into a second set on a separate thread. When both are done, the
+ * buffers of batch N are released and the sets are swapped. On platforms
+ * with on-board memory this overlaps the copy to the device with the
+ * UserCore computation.
+ *
+ * A pipeline takes over the buffer address registers; columns prepared
+ * with the prepare_* functions of the platform are no longer selected.
+ */
+class Pipeline {
+ public:
+  /// Function returning the UserCore arguments of a batch
+  typedef std::function<std::vector<fr_t>(size_t, const std::shared_ptr<arrow::RecordBatch> &)> arguments_t;
+  /// Function called after the UserCore finished a batch, e.g. to collect results
+  typedef std::function<void(size_t, const std::shared_ptr<arrow::RecordBatch> &)> done_t;
+
+  /**
+   * \param platform The platform to stage the batches on.
+   * \param usercore The UserCore that processes the batches.
+   */
+  Pipeline(std::shared_ptr<FPGAPlatform> platform, UserCore &usercore);
+
+  /**
+   * \brief Run the UserCore on all batches.
+   *
+   * \param batches   The batches to process. All batches must have the same schema.
+   * \param arguments Function returning the UserCore arguments of a batch.
+   * \param done      Optional function called after each batch.
+   */
+  uc_stat run(const std::vector<std::shared_ptr<arrow::RecordBatch>> &batches,
+              const arguments_t &arguments,
+              const done_t &done = nullptr);
+
+  /**
+   * \brief Return the timing of the last run.
+   */
+  const PipelineStats &stats();
+
+  /**
+   * \brief Split a table into RecordBatches of at most rows_per_batch rows.
+   *
+   * Batches never span multiple chunks.
+   */
+  static std::vector<std::shared_ptr<arrow::RecordBatch>> split(const std::shared_ptr<arrow::Table> &table,
+                                                                int64_t rows_per_batch);
+
+ private:
+  std::shared_ptr<FPGAPlatform> _platform;
+  UserCore &usercore;
+  PipelineStats _stats;
+};
+
+}
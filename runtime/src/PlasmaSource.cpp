@@ -0,0 +1,105 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdexcept>
+
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <plasma/client.h>
+
+#include "logging.h"
+#include "PlasmaSource.h"
+
+namespace fletcher {
+
+PlasmaSource::PlasmaSource(const std::string &store_socket, int num_retries)
+    : client(new plasma::PlasmaClient) {
+  LOGD("[PlasmaSource] Connecting to Plasma store at " << store_socket);
+
+  auto status = this->client->Connect(store_socket, "", 0, num_retries);
+
+  if (!status.ok()) {
+    LOGE("[PlasmaSource] Could not connect to Plasma store at " << store_socket << ": " << status.ToString()
+                                                                << ". Entering error state.");
+    this->error = true;
+  }
+}
+
+PlasmaSource::~PlasmaSource() {
+  if (!this->error) {
+    this->client->Disconnect();
+  }
+}
+
+bool PlasmaSource::good() {
+  return !this->error;
+}
+
+std::shared_ptr<arrow::RecordBatch> PlasmaSource::get(const std::string &object_id, int64_t timeout_ms) {
+  return get(std::vector<std::string>{object_id}, timeout_ms)[0];
+}
+
+std::vector<std::shared_ptr<arrow::RecordBatch>> PlasmaSource::get(const std::vector<std::string> &object_ids,
+                                                                   int64_t timeout_ms) {
+  if (this->error) {
+    throw std::runtime_error("Plasma source is in error state.");
+  }
+
+  std::vector<plasma::ObjectID> ids;
+  for (auto const &id : object_ids) {
+    if (id.size() != plasma::kUniqueIDSize) {
+      throw std::runtime_error("Plasma object IDs must be " + std::to_string(plasma::kUniqueIDSize) + " bytes.");
+    }
+    ids.push_back(plasma::ObjectID::from_binary(id));
+  }
+
+  // The buffers release their object to the store when they are destroyed
+  std::vector<plasma::ObjectBuffer> objects;
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+    auto status = this->client->Get(ids, timeout_ms, &objects);
+    if (!status.ok()) {
+      throw std::runtime_error("Could not get objects from Plasma store: " + status.ToString());
+    }
+  }
+
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+
+  for (size_t i = 0; i < objects.size(); i++) {
+    auto const &hex = ids[i].hex();
+
+    if (!objects[i].data) {
+      throw std::runtime_error("Plasma object " + hex + " is not available.");
+    }
+
+    // Reading from a BufferReader slices the object buffer instead of copying it
+    std::shared_ptr<arrow::RecordBatchReader> reader;
+    std::shared_ptr<arrow::RecordBatch> batch;
+    auto input = std::make_shared<arrow::io::BufferReader>(objects[i].data);
+
+    if (!arrow::ipc::RecordBatchStreamReader::Open(input, &reader).ok() || !reader->ReadNext(&batch).ok()
+        || !batch) {
+      throw std::runtime_error("Plasma object " + hex + " does not hold an Arrow IPC stream.");
+    }
+
+    LOGD("[PlasmaSource] Object " << hex << ": " << batch->num_rows() << " rows in " << objects[i].data->size()
+                                  << " bytes at " << STRHEX64 << (uint64_t) objects[i].data->data());
+
+    batches.push_back(batch);
+  }
+
+  return batches;
+}
+
+}
@@ -0,0 +1,93 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "common.h"
+
+namespace plasma {
+class PlasmaClient;
+}
+
+namespace fletcher {
+
+/**
+ * \class PlasmaSource
+ * \brief Obtains RecordBatches from sealed objects in a Plasma object store.
+ *
+ * Every object must hold an Arrow IPC stream with a single RecordBatch, as
+ * written by e.g. pyarrow. The batches are read without copies: their
+ * buffers point into the shared memory of the store, so they can be passed
+ * to prepare_recordbatch() or stage_recordbatch() directly. On platforms
+ * where the FPGA accesses host memory, such as SNAP, the FPGA then reads
+ * the objects in the store itself.
+ *
+ * An object stays mapped until the last buffer of its RecordBatch is
+ * destroyed, after which it is released to the store. All RecordBatches
+ * must be destroyed before the PlasmaSource.
+ *
+ * Only available when the runtime is built with the PLASMA option.
+ */
+class PlasmaSource {
+ public:
+  /**
+   * \param store_socket The socket of the Plasma store, e.g. /tmp/plasma.
+   * \param num_retries  The number of connection attempts, or -1 for the
+   *                     default of the Plasma client.
+   */
+  explicit PlasmaSource(const std::string &store_socket, int num_retries = -1);
+
+  ~PlasmaSource();
+
+  /**
+   * \brief Returns true if the store could be connected to.
+   */
+  bool good();
+
+  /**
+   * \brief Get the RecordBatch in an object.
+   *
+   * Throws if the object is not available within timeout_ms milliseconds,
+   * or does not hold a RecordBatch.
+   *
+   * \param object_id  The binary object ID of 20 bytes.
+   * \param timeout_ms The time to wait for the object to be sealed, or -1
+   *                   to wait forever.
+   */
+  std::shared_ptr<arrow::RecordBatch> get(const std::string &object_id, int64_t timeout_ms = -1);
+
+  /**
+   * \brief Get the RecordBatches in a number of objects, in the same order.
+   *
+   * The objects are requested from the store at once. Throws if any of
+   * them is not available within timeout_ms milliseconds.
+   */
+  std::vector<std::shared_ptr<arrow::RecordBatch>> get(const std::vector<std::string> &object_ids,
+                                                       int64_t timeout_ms = -1);
+
+ private:
+  std::unique_ptr<plasma::PlasmaClient> client;
+  std::mutex lock;
+  bool error = false;
+};
+
+}
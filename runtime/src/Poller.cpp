@@ -0,0 +1,146 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "logging.h"
+#include "Poller.h"
+#include "Metrics.h"
+
+namespace fletcher {
+
+static Counter &poll_count = Metrics::global().counter("fletcher_poll_iterations_total",
+                                                       "Number of status register polls.");
+static Counter &sleep_count = Metrics::global().counter("fletcher_poll_sleeps_total",
+                                                        "Number of sleeps while polling.");
+static Histogram &job_time = Metrics::global().histogram("fletcher_job_duration_nanoseconds",
+                                                         "Time from starting a UserCore until it was seen done.");
+
+static inline double seconds_between(std::chrono::steady_clock::time_point a,
+                                     std::chrono::steady_clock::time_point b) {
+  return std::chrono::duration<double>(b - a).count();
+}
+
+Poller::Poller(unsigned int spin_usec, unsigned int min_sleep_usec, unsigned int max_sleep_usec)
+    : spin_usec(spin_usec),
+      min_sleep_usec(std::max(1u, min_sleep_usec)),
+      max_sleep_usec(std::max(min_sleep_usec, max_sleep_usec)) {}
+
+void Poller::start() {
+  this->start_time = clock::now();
+  this->started = true;
+}
+
+PollStats Poller::wait(const std::function<bool()> &done) {
+  PollStats stats;
+
+  if (!this->started) {
+    start();
+  }
+  this->started = false;
+
+  const double spin = this->spin_usec * 1E-6;
+
+  // Long jobs: sleep through most of the expected duration in one go, leaving
+  // the spin window plus some slack for scheduler wake-up latency.
+  if (this->_estimate > 4 * spin) {
+    double remaining = 0.75 * this->_estimate - seconds_between(this->start_time, clock::now()) - spin;
+    if (remaining > 0) {
+      sleep(remaining, stats);
+    }
+  }
+
+  auto previous = clock::now();
+  auto spin_end = previous + std::chrono::microseconds(this->spin_usec);
+  double backoff = this->min_sleep_usec * 1E-6;
+
+  // Back off at most up to a fraction of the expected duration.
+  double max_backoff = this->max_sleep_usec * 1E-6;
+  if (this->_estimate > 0) {
+    max_backoff = std::min(max_backoff, std::max(this->min_sleep_usec * 1E-6, this->_estimate / 8));
+  }
+
+  while (true) {
+    stats.polls++;
+    bool is_done = done();
+    auto now = clock::now();
+
+    if (is_done) {
+      stats.lateness = seconds_between(previous, now);
+      stats.duration = seconds_between(this->start_time, now);
+      break;
+    }
+    previous = now;
+
+    // Spin first, then back off exponentially.
+    if (now >= spin_end) {
+      sleep(backoff, stats);
+      backoff = std::min(2 * backoff, max_backoff);
+    }
+  }
+
+  // Update the running duration estimate
+  if (this->_estimate < 0) {
+    this->_estimate = stats.duration;
+  } else {
+    this->_estimate = (1 - this->estimate_weight) * this->_estimate + this->estimate_weight * stats.duration;
+  }
+
+  stats.jobs = 1;
+
+  poll_count.add(stats.polls);
+  sleep_count.add(stats.sleeps);
+  job_time.observe(static_cast<uint64_t>(stats.duration * 1E9));
+
+  this->_last = stats;
+  this->_total.jobs += stats.jobs;
+  this->_total.polls += stats.polls;
+  this->_total.sleeps += stats.sleeps;
+  this->_total.duration += stats.duration;
+  this->_total.lateness += stats.lateness;
+  this->_total.oversleep += stats.oversleep;
+
+  LOGD("[Poller] Job done after " << stats.duration << " s, " << stats.polls << " polls, "
+                                  << stats.sleeps << " sleeps, lateness " << stats.lateness << " s. "
+                                  << "Estimate now " << this->_estimate << " s.");
+
+  return stats;
+}
+
+double Poller::estimate() {
+  return this->_estimate;
+}
+
+const PollStats &Poller::last() {
+  return this->_last;
+}
+
+const PollStats &Poller::total() {
+  return this->_total;
+}
+
+void Poller::sleep(double seconds, PollStats &stats) {
+  auto before = clock::now();
+  usleep(static_cast<useconds_t>(seconds * 1E6));
+  double slept = seconds_between(before, clock::now());
+
+  stats.sleeps++;
+  if (slept > seconds) {
+    stats.oversleep += slept - seconds;
+  }
+}
+
+}
@@ -0,0 +1,111 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace fletcher {
+
+/**
+ * Statistics of waiting for a single job, or accumulated over many jobs.
+ */
+typedef struct _PollStats {
+  uint64_t jobs = 0;        // Number of jobs waited for
+  uint64_t polls = 0;       // Number of times the status was checked
+  uint64_t sleeps = 0;      // Number of times the poller went to sleep
+  double duration = 0.0;    // Time from job start until completion was observed, in seconds
+  double lateness = 0.0;    // Upper bound of the time between completion and its observation, in seconds
+  double oversleep = 0.0;   // Time slept longer than requested, in seconds
+} PollStats;
+
+/**
+ * \class Poller
+ * \brief Adaptive hybrid spin/sleep completion poller.
+ *
+ * The poller keeps a running estimate of the job duration. Jobs that are
+ * expected to be short are polled by spinning, after which the poller backs
+ * off exponentially by sleeping for increasingly longer intervals. For jobs
+ * that are expected to take long, the poller first sleeps for most of the
+ * expected duration before it starts spinning.
+ *
+ * Every wait records the number of polls and the wake-up lateness, i.e. the
+ * time between the last poll that saw the job busy and the poll that saw it
+ * done, which bounds the latency the poller itself adds.
+ */
+class Poller {
+ public:
+  /**
+   * \param spin_usec      Time to spin before backing off, in microseconds.
+   * \param min_sleep_usec Initial back-off sleep interval, in microseconds.
+   * \param max_sleep_usec Maximum back-off sleep interval, in microseconds.
+   */
+  explicit Poller(unsigned int spin_usec = 50,
+                  unsigned int min_sleep_usec = 1,
+                  unsigned int max_sleep_usec = 1000);
+
+  /**
+   * \brief Mark the start of a job, to measure its duration from.
+   *
+   * If not called, the duration is measured from the start of wait().
+   */
+  void start();
+
+  /**
+   * \brief Poll until done returns true.
+   *
+   * \return statistics about this wait.
+   */
+  PollStats wait(const std::function<bool()> &done);
+
+  /**
+   * \brief Return the running estimate of the job duration, in seconds.
+   */
+  double estimate();
+
+  /**
+   * \brief Return the statistics of the last wait.
+   */
+  const PollStats &last();
+
+  /**
+   * \brief Return the statistics accumulated over all waits.
+   */
+  const PollStats &total();
+
+ private:
+  typedef std::chrono::steady_clock clock;
+
+  unsigned int spin_usec;
+  unsigned int min_sleep_usec;
+  unsigned int max_sleep_usec;
+
+  /// Running estimate of the job duration in seconds, negative if unknown
+  double _estimate = -1.0;
+
+  /// Weight of a new observation in the running estimate
+  double estimate_weight = 0.25;
+
+  bool started = false;
+  clock::time_point start_time;
+
+  PollStats _last;
+  PollStats _total;
+
+  void sleep(double seconds, PollStats &stats);
+};
+
+}
@@ -0,0 +1,359 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+
+#include "logging.h"
+#include "StreamRunner.h"
+#include "Numa.h"
+
+namespace fletcher {
+
+typedef std::chrono::steady_clock stream_clock;
+
+static inline double seconds_since(stream_clock::time_point start) {
+  return std::chrono::duration<double>(stream_clock::now() - start).count();
+}
+
+/**
+ * A queue of at most depth items between two threads. Closing the queue
+ * makes push fail and wakes up all waiting threads, while the items that
+ * are still in the queue can be popped.
+ */
+template<typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t depth) : depth(depth) {}
+
+  /// Push an item, waiting for room. Returns false, leaving item intact, if the queue is closed.
+  bool push(T &item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_full.wait(lock, [this] { return this->closed || this->items.size() < this->depth; });
+    if (this->closed) {
+      return false;
+    }
+    this->items.push_back(std::move(item));
+    this->not_empty.notify_one();
+    return true;
+  }
+
+  /// Pop an item, waiting for one. Returns false if the queue is closed and empty.
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->not_empty.wait(lock, [this] { return this->closed || !this->items.empty(); });
+    if (this->items.empty()) {
+      return false;
+    }
+    item = std::move(this->items.front());
+    this->items.pop_front();
+    this->not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> guard(this->mutex);
+    this->closed = true;
+    this->not_full.notify_all();
+    this->not_empty.notify_all();
+  }
+
+ private:
+  size_t depth;
+  bool closed = false;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+};
+
+/// Tell the kernel the pages of a buffer in a memory-mapped file are no longer needed
+static void drop_pages(const std::shared_ptr<arrow::Buffer> &buffer) {
+  if (!buffer || buffer->size() == 0) {
+    return;
+  }
+  static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+
+  // Only drop pages that lie completely within the buffer; others may be shared with the next batch
+  auto begin = (reinterpret_cast<uintptr_t>(buffer->data()) + page - 1) & ~(page - 1);
+  auto end = (reinterpret_cast<uintptr_t>(buffer->data()) + buffer->size()) & ~(page - 1);
+  if (end > begin) {
+    madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+  }
+}
+
+static void drop_pages(const std::shared_ptr<arrow::ArrayData> &array_data) {
+  for (auto const &buffer : array_data->buffers) {
+    drop_pages(buffer);
+  }
+  for (auto const &child : array_data->child_data) {
+    drop_pages(child);
+  }
+}
+
+StreamRunner::StreamRunner(std::shared_ptr<FPGAPlatform> platform, UserCore &usercore, size_t queue_depth)
+    : _platform(std::move(platform)), usercore(usercore), queue_depth(queue_depth) {
+  if (queue_depth == 0) {
+    throw std::runtime_error("Queue depth of a StreamRunner must be at least one.");
+  }
+}
+
+uc_stat StreamRunner::run(const std::string &path,
+                          const arguments_t &arguments,
+                          const done_t &done,
+                          bool memory_map) {
+  std::shared_ptr<arrow::io::RandomAccessFile> file;
+  arrow::Status status;
+
+  if (memory_map) {
+    std::shared_ptr<arrow::io::MemoryMappedFile> mapped;
+    status = arrow::io::MemoryMappedFile::Open(path, arrow::io::FileMode::READ, &mapped);
+    file = mapped;
+  } else {
+    std::shared_ptr<arrow::io::ReadableFile> readable;
+    status = arrow::io::ReadableFile::Open(path, &readable);
+    file = readable;
+  }
+
+  if (!status.ok()) {
+    throw std::runtime_error("Could not open " + path + ": " + status.ToString());
+  }
+
+  // Try the file format first, it knows the number of batches up front
+  std::shared_ptr<arrow::ipc::RecordBatchFileReader> file_reader;
+  if (arrow::ipc::RecordBatchFileReader::Open(file, &file_reader).ok()) {
+    int num_batches = file_reader->num_record_batches();
+    int b = 0;
+
+    LOGD("[StreamRunner] Reading " << num_batches << " batches from file " << path);
+
+    return run([&file_reader, &b, num_batches, &path]() -> std::shared_ptr<arrow::RecordBatch> {
+      std::shared_ptr<arrow::RecordBatch> batch;
+      if (b < num_batches) {
+        auto rb_status = file_reader->ReadRecordBatch(b++, &batch);
+        if (!rb_status.ok()) {
+          throw std::runtime_error("Could not read batch from " + path + ": " + rb_status.ToString());
+        }
+      }
+      return batch;
+    }, arguments, done, memory_map);
+  }
+
+  // Otherwise, it must be a stream
+  std::shared_ptr<arrow::RecordBatchReader> stream_reader;
+  if (!file->Seek(0).ok() || !arrow::ipc::RecordBatchStreamReader::Open(file, &stream_reader).ok()) {
+    throw std::runtime_error(path + " is not an Arrow IPC file or stream.");
+  }
+
+  LOGD("[StreamRunner] Reading batches from stream " << path);
+
+  return run([&stream_reader, &path]() -> std::shared_ptr<arrow::RecordBatch> {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    auto rb_status = stream_reader->ReadNext(&batch);
+    if (!rb_status.ok()) {
+      throw std::runtime_error("Could not read batch from " + path + ": " + rb_status.ToString());
+    }
+    return batch;
+  }, arguments, done, memory_map);
+}
+
+uc_stat StreamRunner::run(const std::shared_ptr<arrow::RecordBatchReader> &reader,
+                          const arguments_t &arguments,
+                          const done_t &done) {
+  return run([&reader]() -> std::shared_ptr<arrow::RecordBatch> {
+    std::shared_ptr<arrow::RecordBatch> batch;
+    auto status = reader->ReadNext(&batch);
+    if (!status.ok()) {
+      throw std::runtime_error("Could not read batch: " + status.ToString());
+    }
+    return batch;
+  }, arguments, done, false);
+}
+
+uc_stat StreamRunner::run(const next_t &next, const arguments_t &arguments, const done_t &done, bool mapped) {
+  typedef struct _Item {
+    size_t index;
+    std::shared_ptr<arrow::RecordBatch> batch;
+    std::vector<BufConfig> buffers;
+  } Item;
+
+  this->_stats = StreamStats();
+  auto run_start = stream_clock::now();
+
+  BoundedQueue<Item> read_queue(this->queue_depth);
+  BoundedQueue<Item> staged_queue(this->queue_depth);
+
+  // Every thread keeps its own timing and error, to be combined after joining
+  double read_time = 0.0, copy_time = 0.0;
+  uint64_t bytes = 0;
+  std::exception_ptr read_error, stage_error;
+
+  // Set when reading or staging failed; the batches that are still staged are then skipped
+  std::atomic<bool> failed{false};
+
+  std::thread reader([&]() {
+    try {
+      for (size_t b = 0;; b++) {
+        auto start = stream_clock::now();
+        Item item = {b, next(), {}};
+        read_time += seconds_since(start);
+
+        if (!item.batch || !read_queue.push(item)) {
+          break;
+        }
+      }
+    } catch (...) {
+      read_error = std::current_exception();
+      failed = true;
+    }
+    read_queue.close();
+  });
+
+  std::thread stager([&]() {
+    numa_pin_thread(this->_platform->numa_node());
+
+    Item item;
+    try {
+      while (read_queue.pop(item)) {
+        auto start = stream_clock::now();
+        bytes += this->_platform->stage_recordbatch(item.batch, item.buffers);
+        copy_time += seconds_since(start);
+
+        if (!staged_queue.push(item)) {
+          // The run was aborted
+          this->_platform->release_buffers(item.buffers);
+          break;
+        }
+      }
+    } catch (...) {
+      stage_error = std::current_exception();
+      failed = true;
+      read_queue.close();
+    }
+    staged_queue.close();
+  });
+
+  // Stop the other threads and release whatever they staged
+  auto abort = [&]() {
+    read_queue.close();
+    staged_queue.close();
+    Item item;
+    while (staged_queue.pop(item)) {
+      this->_platform->release_buffers(item.buffers);
+    }
+  };
+
+  uc_stat result = SUCCESS;
+  Item item;
+
+  try {
+    while (staged_queue.pop(item)) {
+      if (failed) {
+        this->_platform->release_buffers(item.buffers);
+        item.buffers.clear();
+        continue;
+      }
+
+      auto compute_start = stream_clock::now();
+
+      this->usercore.reset();
+
+      // Don't start the UserCore on buffers or arguments that were not written, but still clean up below
+      uc_stat stat = FAILURE;
+      if (this->usercore.activate_buffers(item.buffers) == SUCCESS
+          && this->usercore.set_arguments(arguments(item.index, item.batch)) == SUCCESS) {
+        this->usercore.start();
+        stat = this->usercore.wait_for_finish();
+      }
+
+      this->_stats.compute += seconds_since(compute_start);
+
+      if (stat == SUCCESS && done) {
+        done(item.index, item.batch);
+      }
+
+      this->_platform->release_buffers(item.buffers);
+      item.buffers.clear();
+
+      if (stat != SUCCESS) {
+        LOGE("[StreamRunner] UserCore failed on batch " << item.index << ".");
+        result = FAILURE;
+        abort();
+        break;
+      }
+
+      this->_stats.batches++;
+      this->_stats.rows += item.batch->num_rows();
+
+      if (mapped) {
+        for (int c = 0; c < item.batch->num_columns(); c++) {
+          drop_pages(item.batch->column_data(c));
+        }
+      }
+    }
+  } catch (...) {
+    this->_platform->release_buffers(item.buffers);
+    abort();
+    reader.join();
+    stager.join();
+    throw;
+  }
+
+  reader.join();
+  stager.join();
+
+  this->_stats.read = read_time;
+  this->_stats.copy = copy_time;
+  this->_stats.bytes = bytes;
+  this->_stats.total = seconds_since(run_start);
+
+  if (read_error) {
+    std::rethrow_exception(read_error);
+  }
+  if (stage_error) {
+    std::rethrow_exception(stage_error);
+  }
+
+  LOGD("[StreamRunner] " << this->_stats.batches << " batches, " << this->_stats.rows << " rows, "
+                         << this->_stats.bytes << " bytes. Read: " << this->_stats.read << " s, copy: "
+                         << this->_stats.copy << " s, compute: " << this->_stats.compute << " s, total: "
+                         << this->_stats.total << " s.");
+
+  return result;
+}
+
+void StreamRunner::set_queue_depth(size_t queue_depth) {
+  if (queue_depth == 0) {
+    throw std::runtime_error("Queue depth of a StreamRunner must be at least one.");
+  }
+  this->queue_depth = queue_depth;
+}
+
+const StreamStats &StreamRunner::stats() {
+  return this->_stats;
+}
+
+}
@@ -0,0 +1,129 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "common.h"
+#include "FPGAPlatform.h"
+#include "UserCore.h"
+#include "Pipeline.h"
+
+#define STREAM_DEFAULT_QUEUE_DEPTH 2
+
+namespace fletcher {
+
+/**
+ * Timing of a streaming run. All times are in seconds.
+ */
+typedef struct _StreamStats {
+  uint64_t batches = 0;   // Number of batches processed
+  uint64_t rows = 0;      // Number of rows processed
+  uint64_t bytes = 0;     // Number of bytes staged
+  double read = 0.0;      // Total time spent reading batches from the source
+  double copy = 0.0;      // Total time spent staging batches
+  double compute = 0.0;   // Total time spent running the UserCore
+  double total = 0.0;     // Wall-clock time of the whole run
+} StreamStats;
+
+/**
+ * \class StreamRunner
+ * \brief Runs a UserCore on an Arrow IPC stream or file, batch by batch.
+ *
+ * Unlike Pipeline, the batches need not be in memory beforehand. A reader
+ * thread reads RecordBatches from the source, a staging thread stages them
+ * on the platform and the calling thread runs the UserCore on them. The
+ * stages are connected by queues of at most queue_depth batches, such that
+ * the number of batches in memory is bounded, regardless of the size of the
+ * source.
+ *
+ * Files are memory-mapped by default. The batches then refer to the mapped
+ * file instead of being copied, and the kernel can drop their pages once
+ * they are processed.
+ *
+ * A runner takes over the buffer address registers; columns prepared with
+ * the prepare_* functions of the platform are no longer selected.
+ */
+class StreamRunner {
+ public:
+  typedef Pipeline::arguments_t arguments_t;
+  typedef Pipeline::done_t done_t;
+
+  /**
+   * \param platform    The platform to stage the batches on.
+   * \param usercore    The UserCore that processes the batches.
+   * \param queue_depth The maximum number of batches waiting in between
+   *                    reading, staging and running.
+   */
+  StreamRunner(std::shared_ptr<FPGAPlatform> platform,
+               UserCore &usercore,
+               size_t queue_depth = STREAM_DEFAULT_QUEUE_DEPTH);
+
+  /**
+   * \brief Run the UserCore on all batches of an Arrow IPC file or stream.
+   *
+   * The format is detected from the file contents.
+   *
+   * \param path        The file to read.
+   * \param arguments   Function returning the UserCore arguments of a batch.
+   * \param done        Optional function called after each batch.
+   * \param memory_map  Whether to memory-map the file instead of reading it.
+   */
+  uc_stat run(const std::string &path,
+              const arguments_t &arguments,
+              const done_t &done = nullptr,
+              bool memory_map = true);
+
+  /**
+   * \brief Run the UserCore on all batches of a RecordBatchReader, e.g. a
+   * RecordBatchStreamReader on a socket or pipe.
+   */
+  uc_stat run(const std::shared_ptr<arrow::RecordBatchReader> &reader,
+              const arguments_t &arguments,
+              const done_t &done = nullptr);
+
+  /**
+   * \brief Set the maximum number of batches waiting in between stages.
+   */
+  void set_queue_depth(size_t queue_depth);
+
+  /**
+   * \brief Return the timing of the last run.
+   */
+  const StreamStats &stats();
+
+ private:
+  /// Function obtaining the next batch, returning nullptr at the end
+  typedef std::function<std::shared_ptr<arrow::RecordBatch>()> next_t;
+
+  std::shared_ptr<FPGAPlatform> _platform;
+  UserCore &usercore;
+  size_t queue_depth;
+  StreamStats _stats;
+
+  /**
+   * Run the reader, staging and UserCore stages. If mapped is true, the
+   * batches refer to a memory-mapped file, of which the pages are dropped
+   * once a batch is processed.
+   */
+  uc_stat run(const next_t &next, const arguments_t &arguments, const done_t &done, bool mapped);
+};
+
+}
@@ -14,14 +14,21 @@
 
 #include <unistd.h>
 
+#include <stdexcept>
+
 #include "logging.h"
 #include "UserCore.h"
+#include "Job.h"
+#include "Metrics.h"
 
 namespace fletcher {
 
-UserCore::UserCore(std::shared_ptr<FPGAPlatform> platform) {
+static Counter &poll_count = Metrics::global().counter("fletcher_poll_iterations_total",
+                                                       "Number of status register polls.");
+
+UserCore::UserCore(std::shared_ptr<FPGAPlatform> platform, uint64_t window) {
   this->_platform = platform;
-  this->arg_offset = this->_platform->argument_offset();
+  this->_window = window;
 }
 
 bool UserCore::implements_schema(const std::shared_ptr<arrow::Schema> &schema) {
@@ -31,59 +38,171 @@ bool UserCore::implements_schema(const std::shared_ptr<arrow::Schema> &schema) {
 }
 
 uc_stat UserCore::reset() {
-  this->_platform->write_mmio(UC_REG_CONTROL, this->ctrl_reset);
+  this->_platform->write_mmio(this->_window + UC_REG_CONTROL, this->ctrl_reset);
   return SUCCESS;
 }
 
 uc_stat UserCore::set_arguments(std::vector<fr_t> arguments) {
-  LOGD("Setting arguments. Argument offset: " << this->arg_offset);
-  for (int i = 0; (size_t) i < arguments.size(); i++) {
-    this->_platform->write_mmio(this->arg_offset + i, arguments[i]);
+  // The argument offset depends on the buffers prepared on the platform, which may change between runs.
+  uint64_t arg_offset = this->_platform->argument_offset(this->_window);
+
+  LOGD("Setting arguments. Argument offset: " << arg_offset);
+  if (this->_platform->write_mmio_batch(arg_offset, arguments.data(), arguments.size()) != OK) {
+    return FAILURE;
   }
 
   return SUCCESS;
 }
 
+uc_stat UserCore::activate_buffers(const std::vector<BufConfig> &dest_buffers) {
+  if (this->_platform->activate_buffers(dest_buffers, this->_window) != OK) {
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
 uc_stat UserCore::start() {
-  this->_platform->write_mmio(UC_REG_CONTROL, this->ctrl_start);
+  this->_poller.start();
+  this->_platform->write_mmio(this->_window + UC_REG_CONTROL, this->ctrl_start);
   return SUCCESS;
 }
 
+std::shared_ptr<Job> UserCore::start_async(const std::function<void(Job &)> &callback) {
+  auto job = std::make_shared<Job>(this->_platform, this->done_status, this->done_status_mask, this->_window);
+
+  if (callback) {
+    job->on_done(callback);
+  }
+
+  this->start();
+
+  return job;
+}
+
 fr_t UserCore::get_status() {
   fr_t ret = 0xDEAFBEEF;
-  _platform->read_mmio(UC_REG_STATUS, &ret);
+  _platform->read_mmio(this->_window + UC_REG_STATUS, &ret);
   return ret;
 }
 
+uint64_t UserCore::window() {
+  return this->_window;
+}
+
+void UserCore::set_counters(uint64_t offset, size_t num_readers) {
+  this->_counter_offset = offset;
+  this->_counter_readers = num_readers;
+  this->_has_counters = true;
+}
+
+UserCoreCounters UserCore::read_counters() {
+  if (!this->_has_counters) {
+    throw std::runtime_error("UserCore has no performance counters.");
+  }
+
+  // The busy cycles, followed by the counters of every reader
+  std::vector<fr_t> values(1 + UC_COUNTERS_PER_READER * this->_counter_readers);
+  if (this->_platform->read_mmio_batch(this->_window + this->_counter_offset, values.data(), values.size()) != OK) {
+    throw std::runtime_error("Could not read performance counters.");
+  }
+
+  UserCoreCounters counters;
+  counters.busy_cycles = values[0];
+  for (size_t r = 0; r < this->_counter_readers; r++) {
+    const fr_t *reader = &values[1 + UC_COUNTERS_PER_READER * r];
+    ReaderCounters rc;
+    rc.bytes_read = reader[0];
+    rc.request_stall_cycles = reader[1];
+    rc.data_stall_cycles = reader[2];
+    rc.grants = reader[3];
+    counters.readers.push_back(rc);
+  }
+
+  return counters;
+}
+
 fr_t UserCore::get_return() {
   fr_t ret = 0xDEAFBEEF;
-  _platform->read_mmio(UC_REG_RETURN, &ret);
+  _platform->read_mmio(this->_window + UC_REG_RETURN, &ret);
   return ret;
 }
 
 uc_stat UserCore::wait_for_finish() {
-  return wait_for_finish(0);
+  if (this->platform()->good()) {
+    bool failed = false;
+    this->_poller.wait([this, &failed]() -> bool {
+      fr_t status = 0;
+      if (this->_platform->read_mmio(this->_window + UC_REG_STATUS, &status) != OK) {
+        failed = true;
+        return true;
+      }
+      return (status & this->done_status_mask) == this->done_status;
+    });
+    return failed ? FAILURE : SUCCESS;
+  } else {
+    return FAILURE;
+  }
+}
+
+Poller &UserCore::poller() {
+  return this->_poller;
 }
 
 uc_stat UserCore::wait_for_finish(unsigned int poll_interval_usec) {
   if (this->platform()->good()) {
     fr_t status = 0;
+    uint64_t polls = 0;
     if (poll_interval_usec == 0) {
       do {
-        this->_platform->read_mmio(UC_REG_STATUS, &status);
+        this->_platform->read_mmio(this->_window + UC_REG_STATUS, &status);
+        polls++;
       } while ((status & this->done_status_mask) != this->done_status);
     } else {
       do {
         usleep(poll_interval_usec);
-        this->_platform->read_mmio(UC_REG_STATUS, &status);
+        this->_platform->read_mmio(this->_window + UC_REG_STATUS, &status);
+        polls++;
       } while ((status & this->done_status_mask) != this->done_status);
     }
+    poll_count.add(polls);
     return SUCCESS;
   } else {
     return FAILURE;
   }
 }
 
+uc_stat UserCore::run_chunks(const std::function<std::vector<fr_t>(size_t, const ChunkConfig &)> &chunk_arguments,
+                             const std::function<void(size_t)> &chunk_done,
+                             unsigned int poll_interval_usec) {
+  size_t num_chunks = this->_platform->num_chunks();
+
+  for (size_t c = 0; c < num_chunks; c++) {
+    LOGD("Running chunk " << c << " of " << num_chunks);
+
+    this->reset();
+
+    if (this->_platform->select_chunk(c, this->_window) != OK) {
+      return FAILURE;
+    }
+
+    if (this->set_arguments(chunk_arguments(c, this->_platform->chunk_config(c))) != SUCCESS) {
+      return FAILURE;
+    }
+    this->start();
+
+    uc_stat stat = poll_interval_usec == 0 ? this->wait_for_finish() : this->wait_for_finish(poll_interval_usec);
+    if (stat != SUCCESS) {
+      return FAILURE;
+    }
+
+    if (chunk_done) {
+      chunk_done(c);
+    }
+  }
+
+  return SUCCESS;
+}
+
 std::shared_ptr<FPGAPlatform> UserCore::platform() {
   return this->_platform;
 }
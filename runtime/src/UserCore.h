@@ -16,20 +16,41 @@
 
 #include <cstdint>
 #include <vector>
+#include <functional>
 
 #include <arrow/api.h>
 
 #include "common.h"
 #include "FPGAPlatform.h"
+#include "Poller.h"
 
 namespace fletcher {
 
+class Job;
+
 // Return values for UserCore functions
 typedef enum {
   FAILURE,
   SUCCESS
 } uc_stat;
 
+/// The number of 64-bit performance counters per column reader
+#define UC_COUNTERS_PER_READER 4
+
+/// Performance counters of a column reader
+typedef struct _ReaderCounters {
+  uint64_t bytes_read = 0;           ///< Bytes read over the bus
+  uint64_t request_stall_cycles = 0; ///< Cycles a read request was not accepted by the arbiter
+  uint64_t data_stall_cycles = 0;    ///< Cycles read data was not accepted by the reader
+  uint64_t grants = 0;               ///< Read requests granted by the arbiter
+} ReaderCounters;
+
+/// Performance counters of a wrapper generated with fletchgen --perf_counters
+typedef struct _UserCoreCounters {
+  uint64_t busy_cycles = 0;             ///< Cycles the UserCore was busy
+  std::vector<ReaderCounters> readers;  ///< Counters of every column reader
+} UserCoreCounters;
+
 /**
  * \class UserCore
  * \brief Abstract class for UserCore management
@@ -38,10 +59,20 @@ typedef enum {
  * implementation.
  * You don't -have- to use this class, but it could be used as a way to
  * interface on the software side of Fletcher in a similar way.
+ *
+ * A UserCore accesses only the registers in its own register window. The
+ * UserCores of different windows on the same platform can be driven from
+ * different threads at the same time; a single UserCore must be driven
+ * from one thread at a time.
  */
 class UserCore {
  public:
-  explicit UserCore(std::shared_ptr<FPGAPlatform> platform);
+  /**
+   * \param platform The platform the UserCore is on.
+   * \param window   The offset of the status register of this UserCore,
+   *                 for images with several UserCores.
+   */
+  explicit UserCore(std::shared_ptr<FPGAPlatform> platform, uint64_t window = 0);
 
   /**
    * \brief Check if the Schema of this UserCore is compatible with another Schema
@@ -58,11 +89,25 @@ class UserCore {
    */
   uc_stat set_arguments(std::vector<fr_t> arguments);
 
+  /**
+   * \brief Point the buffer address registers of this UserCore to buffers
+   * staged with FPGAPlatform::stage_recordbatch().
+   */
+  uc_stat activate_buffers(const std::vector<BufConfig> &dest_buffers);
+
   /**
    * \brief Start the UserCore
    */
   uc_stat start();
 
+  /**
+   * \brief Start the UserCore without waiting for it to finish.
+   *
+   * \param callback Optional function to call when the job is done.
+   * \return a handle to poll or wait for the job.
+   */
+  std::shared_ptr<Job> start_async(const std::function<void(Job &)> &callback = nullptr);
+
   /**
    * \brief Read the status register of the UserCore
    */
@@ -83,10 +128,58 @@ class UserCore {
   /**
    * \brief A blocking function that waits for the UserCore to finish
    * 
-   * Polls at maximum speed
+   * Polls adaptively: spins briefly, then backs off exponentially, based on
+   * a running estimate of the job duration. See Poller.
    */
   uc_stat wait_for_finish();
 
+  /**
+   * \brief Return the adaptive poller used by wait_for_finish(), e.g. to
+   * obtain its statistics.
+   */
+  Poller &poller();
+
+  /**
+   * \brief Return the register window of this UserCore.
+   */
+  uint64_t window();
+
+  /**
+   * \brief Set the location of the performance counters.
+   *
+   * \param offset      The 64-bit register of the first counter, as noted
+   *                    by fletchgen in the generated wrapper, relative to
+   *                    the register window.
+   * \param num_readers The number of column readers of the wrapper.
+   */
+  void set_counters(uint64_t offset, size_t num_readers);
+
+  /**
+   * \brief Read the performance counters of the last run.
+   *
+   * The counters are cleared by the hardware when the UserCore is started.
+   * Throws if no counters were set with set_counters() or if they could
+   * not be read.
+   */
+  UserCoreCounters read_counters();
+
+  /**
+   * \brief Run the UserCore on all prepared chunks, back to back.
+   *
+   * For every chunk, the UserCore is reset, the buffer address registers
+   * are pointed to the chunk, the arguments obtained from chunk_arguments
+   * are set and the UserCore is started and waited for.
+   *
+   * \param chunk_arguments    Function returning the arguments for a chunk.
+   * \param chunk_done         Optional function called after each chunk
+   *                           finished, e.g. to collect its results.
+   * \param poll_interval_usec The polling interval of wait_for_finish, or 0
+   *                           to poll adaptively.
+   */
+  uc_stat run_chunks(const std::function<std::vector<fr_t>(size_t, const ChunkConfig &)> &chunk_arguments,
+                     const std::function<void(size_t)> &chunk_done = nullptr,
+                     unsigned int poll_interval_usec = 0);
+
  protected:
   /**
    * Get the platform this UserCore is attached to.
@@ -102,7 +195,13 @@ class UserCore {
  private:
   std::shared_ptr<FPGAPlatform> _platform;
 
-  uint64_t arg_offset;
+  uint64_t _window;
+
+  Poller _poller;
+
+  uint64_t _counter_offset = 0;
+  size_t _counter_readers = 0;
+  bool _has_counters = false;
 };
 
 }
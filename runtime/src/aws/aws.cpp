@@ -14,11 +14,13 @@
 
 #include <fcntl.h>
 #include <unistd.h>
-#include <omp.h>
+
+#include <cstring>
 
 #include <arrow/api.h>
 
 #include "../logging.h"
+#include "../Metrics.h"
 
 #include "aws.h"
 
@@ -29,7 +31,23 @@ extern "C" {
 
 namespace fletcher {
 
-AWSPlatform::AWSPlatform(int slot_id, int pf_id, int bar_id)
+static Counter &migrated_pages = Metrics::global().counter("fletcher_numa_migrated_pages_total",
+                                                          "Number of host pages moved to the NUMA node of the FPGA.",
+                                                          "platform=\"aws\"");
+static Counter &mmio_write_calls = Metrics::global().counter("fletcher_mmio_calls_total",
+                                                            "Number of MMIO calls.",
+                                                            "platform=\"aws\",op=\"write\"");
+static Counter &mmio_read_calls = Metrics::global().counter("fletcher_mmio_calls_total",
+                                                           "Number of MMIO calls.",
+                                                           "platform=\"aws\",op=\"read\"");
+static Counter &mmio_write_regs = Metrics::global().counter("fletcher_mmio_registers_total",
+                                                           "Number of 64-bit registers accessed over MMIO.",
+                                                           "platform=\"aws\",op=\"write\"");
+static Counter &mmio_read_regs = Metrics::global().counter("fletcher_mmio_registers_total",
+                                                          "Number of 64-bit registers accessed over MMIO.",
+                                                          "platform=\"aws\",op=\"read\"");
+
+AWSPlatform::AWSPlatform(int slot_id, int pf_id, int bar_id, const std::string &edma_path_format, int num_queues)
     : slot_id(slot_id),
       pf_id(pf_id),
       bar_id(bar_id) {
@@ -46,28 +64,49 @@ AWSPlatform::AWSPlatform(int slot_id, int pf_id, int bar_id)
 
   LOGD("[AWSPlatform] Slot config: " << check_slot_config());
 
-  // Open files for all queues
-  for (int q = 0; q < AWS_NUM_QUEUES; q++) {
-    // Get the EDMA device filename
-    sprintf(device_filename, "/dev/edma%i_queue_%i", slot_id, q);
+  // The EDMA queues are driven from the socket the FPGA is attached to
+  struct fpga_slot_spec spec;
+  if (fpga_pci_get_slot_spec(slot_id, &spec) == 0) {
+    auto const &map = spec.map[pf_id];
+    char address[32];
+    snprintf(address, sizeof(address), "%04x:%02x:%02x.%x", map.domain, map.bus, map.dev, map.func);
+    node = numa_node_of_pci_device(address);
+  } else {
+    LOGD("[AWSPlatform] Could not obtain the PCI address of slot " << slot_id << ", NUMA node is unknown.");
+  }
+
+  // Open the files for all queues. The copy engine keeps them open until
+  // the platform is destroyed.
+  std::vector<std::string> queue_paths;
+  for (int q = 0; q < num_queues; q++) {
+    char device_filename[256];
+    snprintf(device_filename, sizeof(device_filename), edma_path_format.c_str(), slot_id, q);
+    queue_paths.emplace_back(device_filename);
+  }
 
-    // Attempt to open the EDMA file
-    LOGD("[AWSPlatform] Attempting to open device file " << device_filename);
-    edma_fd[q] = open(device_filename, O_RDWR);
+  engine.reset(new CopyEngine(queue_paths, AWS_QUEUE_THRESHOLD, node));
 
-    if (edma_fd[q] < 0) {
-      LOGE("[AWSPlatform] Did not get a valid file descriptor. FD: " << edma_fd[q]
-                                                                     << ". Is the EDMA driver installed? Entering error state.");
-      error = true;
-      return;
-    }
+  if (!engine->good()) {
+    LOGE("[AWSPlatform] Could not open all EDMA queues. Is the EDMA driver installed? Entering error state.");
+    error = true;
+    return;
   }
+
   // Set the PCI bar handle init
   pci_bar_handle = PCI_BAR_HANDLE_INIT;
 
   // Attach the PCI to the FPGA
   LOGD("[AWSPlatform] Attaching PCI <-> FPGA");
-  int ret = fpga_pci_attach(slot_id, pf_id, bar_id, 0, &pci_bar_handle);
+  int ret = fpga_pci_attach(slot_id, pf_id, bar_id, BURST_CAPABLE, &pci_bar_handle);
+
+  if (ret == 0) {
+    burst_capable = true;
+  } else {
+    // Only prefetchable BARs can be mapped write-combined for bursts
+    LOGD("[AWSPlatform] BAR " << bar_id << " is not burst capable, writing registers one by one.");
+    pci_bar_handle = PCI_BAR_HANDLE_INIT;
+    ret = fpga_pci_attach(slot_id, pf_id, bar_id, 0, &pci_bar_handle);
+  }
 
   if (ret != 0) {
     LOGE("[AWSPlatform] Could not attach PCI <-> FPGA. Are you running as root? Entering error state. fpga_pci_attach: "
@@ -78,81 +117,35 @@ AWSPlatform::AWSPlatform(int slot_id, int pf_id, int bar_id)
 
 AWSPlatform::~AWSPlatform() {
   fpga_pci_detach(this->pci_bar_handle);
-
-  for (int q : edma_fd) {
-    close(q);
-  }
 }
 
 size_t AWSPlatform::copy_to_ddr(uint8_t *source, fa_t address, size_t bytes) {
   size_t total = 0;
   if (!error) {
-
-    size_t written[AWS_NUM_QUEUES] = {0};
-
-    int queues = AWS_NUM_QUEUES;
-
-    // Only use more queues if the data to copy is larger than the queue threshold
-    if (bytes < AWS_QUEUE_THRESHOLD) {
-      queues = 1;
+    if (migrate_inputs) {
+      migrated_pages.add(numa_migrate(source, bytes, node));
     }
+    total = engine->write(source, address, bytes);
+  }
+  return total;
+}
 
-    size_t qbytes = bytes / queues;
-
-    //omp_set_num_threads(queues);
-    // For each queue
-//#pragma omp parallel for
-    for (int q = 0; q < queues; q++) {
-      ssize_t rc = 0;
-      // Determine number of bytes for the whole transfer
-      size_t qtotal = qbytes;
-      auto *qsource = (void *) ((uint64_t) source + q * qbytes);
-      fa_t qdest = address + qbytes * q;
-
-      // For the last queue check how many extra bytes we must copy
-      if (q == queues - 1) {
-        qtotal = qbytes + (bytes % queues);
-      }
-
-      LOGD("[AWSPlatform] Copying " << std::dec << (uint64_t) qtotal << " bytes from host: " << STRHEX64
-                                    << (uint64_t) qsource << " --> on-board DDR: " << STRHEX64 << qdest
-                                    << " over queue " << q);
-
-      while (written[q] < qtotal) {
-        if (written[q] != 0) {
-          LOGD("[AWSPlatform] Partial copy, attempting to finish copy. " << written[q] << " out of " << qtotal << ", "
-                                                                         << qtotal - written[q] << " remaining.");
-        }
-        // Write some bytes
-        rc = pwrite(edma_fd[q],
-                    (void *) ((uint64_t) qsource + written[q]),
-                    qtotal - written[q],
-                    qdest + written[q]);
-
-        // If rc is negative there is something else going wrong. Abort the mission
-        if (rc < 0) {
-          LOGE("[AWSPlatform] Copy to DDR failed, Queue: " << q << " RC=" << rc);
-          throw std::runtime_error("Copy to DDR failed.");
-        }
-        written[q] += rc;
-      }
-    }
-    for (int q = 0; q < queues; q++) {
-      total += written[q];
-
-      // Synchronize the files
-      fsync(edma_fd[q]);
-    }
+size_t AWSPlatform::copy_from_ddr(uint8_t *dest, fa_t address, size_t bytes) {
+  size_t total = 0;
+  if (!error) {
+    total = engine->read(dest, address, bytes);
   }
   return total;
 }
 
-int AWSPlatform::check_ddr(uint8_t *source, fa_t offset, size_t size) {
-  ssize_t rc = 0;
+uint64_t AWSPlatform::copy_from_device(fa_t address, uint8_t *dest, uint64_t bytes) {
+  return copy_from_ddr(dest, address, (size_t) bytes);
+}
 
+int AWSPlatform::check_ddr(uint8_t *source, fa_t offset, size_t size) {
   auto *check_buffer = (uint8_t *) malloc(size);
 
-  rc = pread(edma_fd[0], check_buffer, size, offset);
+  copy_from_ddr(check_buffer, offset, size);
 
   int ret = memcmp(source, check_buffer, size);
 
@@ -161,15 +154,19 @@ int AWSPlatform::check_ddr(uint8_t *source, fa_t offset, size_t size) {
   return ret;
 }
 
+void AWSPlatform::set_queue_threshold(size_t threshold) {
+  if (engine) {
+    engine->set_split_threshold(threshold);
+  }
+}
+
 uint64_t AWSPlatform::organize_buffers(const std::vector<BufConfig> &source_buffers,
                                        std::vector<BufConfig> &dest_buffers) {
   uint64_t bytes = 0;
   if (!error) {
     LOGD("[AWSPlatform] Organizing buffers.");
 
-    // First buffer goes to address 0 for now
-    // TODO: manage memory on on-board DDR
-    uint64_t address = 0x0;
+    size_t first = dest_buffers.size();
 
     for (unsigned int i = 0; i < source_buffers.size(); i++) {
       BufConfig source_buf = source_buffers[i];
@@ -177,10 +174,55 @@ uint64_t AWSPlatform::organize_buffers(const std::vector<BufConfig> &source_buff
       LOGD("[AWSPlatform] Source buffer: " << source_buf.name << ", " << std::dec << source_buf.size << ", "
                                            << source_buf.capacity << ", " << STRHEX64 << source_buf.address);
 
-      // Align the buffer address to the next aligned address, if it's not
-      // aligned already.
-      if (address % alignment != 0) {
-        address = (address / alignment + 1) * alignment;
+      // Buffers that are still resident in on-board memory need not be copied again.
+      fa_t address = 0;
+      if (cache) {
+        bool resident;
+        try {
+          resident = cache->acquire(source_buf, alignment, &address);
+        } catch (const std::runtime_error &e) {
+          // Unpin what was acquired by this call before giving up
+          std::vector<BufConfig> acquired(dest_buffers.begin() + first, dest_buffers.end());
+          free_buffers(acquired);
+          dest_buffers.resize(first);
+          throw;
+        }
+
+        BufConfig dest_buf = source_buf;
+        dest_buf.address = address;
+        dest_buffers.push_back(dest_buf);
+
+        if (resident) {
+          LOGD("[AWSPlatform] Buffer " << source_buf.name << " is resident at " << STRHEX64 << address);
+          continue;
+        }
+
+        LOGD("[AWSPlatform] Copying buffers to DDR...");
+        try {
+          bytes += copy_to_ddr(reinterpret_cast<uint8_t *>(source_buf.address), address, (size_t) source_buf.size);
+        } catch (const std::runtime_error &e) {
+          // The device copy is incomplete, it must never be hit
+          cache->discard(address);
+          dest_buffers.pop_back();
+          // Unpin what was acquired by this call before giving up
+          std::vector<BufConfig> acquired(dest_buffers.begin() + first, dest_buffers.end());
+          free_buffers(acquired);
+          dest_buffers.resize(first);
+          throw;
+        }
+        cache->validate(address);
+        continue;
+      }
+
+      // Allocate an aligned block of on-board memory for the buffer.
+      if (ddr.allocate((uint64_t) source_buf.capacity, alignment, &address) != fletcher::OK) {
+        LOGE("[AWSPlatform] Out of on-board memory. Allocated: " << ddr.allocated() << " of " << ddr.size()
+                                                                  << " bytes. Requested: " << source_buf.capacity);
+        // Free what was allocated by this call before giving up
+        std::vector<BufConfig> allocated(dest_buffers.begin() + first, dest_buffers.end());
+        free_buffers(allocated);
+        dest_buffers.resize(first);
+        throw std::runtime_error("Out of on-board memory.");
       }
 
       BufConfig dest_buf;
@@ -194,9 +236,18 @@ uint64_t AWSPlatform::organize_buffers(const std::vector<BufConfig> &source_buff
       // Copy each of the buffers to the FPGA board memory
 
       LOGD("[AWSPlatform] Copying buffers to DDR...");
-      bytes += copy_to_ddr(reinterpret_cast<uint8_t *>(source_buf.address),
-                           (fa_t) dest_buf.address,
-                           (size_t) dest_buf.size);
+      try {
+        bytes += copy_to_ddr(reinterpret_cast<uint8_t *>(source_buf.address),
+                             (fa_t) dest_buf.address,
+                             (size_t) dest_buf.size);
+      } catch (const std::runtime_error &e) {
+        // Free this block and what was allocated by this call before giving up
+        ddr.free(address);
+        std::vector<BufConfig> allocated(dest_buffers.begin() + first, dest_buffers.end());
+        free_buffers(allocated);
+        dest_buffers.resize(first);
+        throw;
+      }
 
       // Check ddr:
 #ifdef DEBUG
@@ -207,33 +258,46 @@ uint64_t AWSPlatform::organize_buffers(const std::vector<BufConfig> &source_buff
       LOGD(diff << "\n");
 #endif
 
-      // Set the buffer address in the MMSRs:
-      write_mmio(UC_REG_BUFFERS + i, (fr_t) dest_buf.address);
-
       dest_buffers.push_back(dest_buf);
-
-      // Calculate the next buffer address
-      address += source_buf.capacity;
     }
   }
-  // Make sure all bytes are copied.
-  for (int q : edma_fd) {
-    LOGD("[AWSPlatform] Emptying queue " << q);
-    fsync(q);
-  }
+  return bytes;
+}
 
-  // Close the files:
-  for (int q = 0; q < AWS_NUM_QUEUES; q++) {
-    if (edma_fd[q] >= 0) {
-      close(edma_fd[q]);
+void AWSPlatform::free_buffers(const std::vector<BufConfig> &dest_buffers) {
+  for (auto const &buf : dest_buffers) {
+    if (cache) {
+      // Keep the buffer resident for later use
+      cache->release(buf.address);
+    } else {
+      LOGD("[AWSPlatform] Freeing on-board buffer " << buf.name << " at " << STRHEX64 << buf.address);
+      ddr.free(buf.address);
     }
   }
+}
 
-  return bytes;
+void AWSPlatform::enable_cache(bool fingerprint) {
+  cache.reset(new BufferCache(ddr, fingerprint));
+}
+
+void AWSPlatform::invalidate_cache() {
+  if (cache) {
+    cache->invalidate();
+  }
+}
+
+CacheStats AWSPlatform::cache_stats() {
+  if (cache) {
+    return cache->stats();
+  }
+  return CacheStats();
 }
 
 int AWSPlatform::write_mmio(uint64_t offset, fr_t value) {
   if (!error) {
+    mmio_write_calls.add();
+    mmio_write_regs.add();
+
     int rc = 0;
     reg_conv_t conv_value;
     conv_value.full = value;
@@ -256,8 +320,73 @@ int AWSPlatform::write_mmio(uint64_t offset, fr_t value) {
   return fletcher::OK;
 }
 
+int AWSPlatform::write_mmio_batch(uint64_t offset, const fr_t *values, size_t count) {
+  // Like write_mmio, writes in the error state are dropped silently
+  if (error) {
+    return fletcher::OK;
+  }
+
+  // Every 64-bit register is two 32-bit registers, high word first
+  std::vector<uint32_t> dwords(2 * count);
+  for (size_t i = 0; i < count; i++) {
+    reg_conv_t conv_value;
+    conv_value.full = values[i];
+    dwords[2 * i] = conv_value.half.hi;
+    dwords[2 * i + 1] = conv_value.half.lo;
+  }
+
+  if (!burst_capable) {
+    return FPGAPlatform::write_mmio_batch(offset, values, count);
+  }
+
+  LOGD("[AWSPlatform] AWS fpga_pci_write_burst " << std::dec << count << " regs from reg " << (2 * offset)
+                                                 << " addr " << STRHEX64 << (4 * (2 * offset)));
+
+  if (fpga_pci_write_burst(pci_bar_handle, 4 * (2 * offset), dwords.data(), dwords.size()) != 0) {
+    LOGD("[AWSPlatform] Burst write failed, writing registers one by one.");
+    return FPGAPlatform::write_mmio_batch(offset, values, count);
+  }
+
+  mmio_write_calls.add();
+  mmio_write_regs.add(count);
+
+  return fletcher::OK;
+}
+
+int AWSPlatform::read_mmio_batch(uint64_t offset, fr_t *dest, size_t count) {
+  if (error) {
+    return fletcher::ERROR;
+  }
+
+  // The length is in bytes: two 32-bit registers of four bytes per 64-bit register
+  void *address = nullptr;
+  if (fpga_pci_get_address(pci_bar_handle, 4 * (2 * offset), 4 * (2 * count), &address) != 0) {
+    LOGD("[AWSPlatform] Could not map registers, reading them one by one.");
+    return FPGAPlatform::read_mmio_batch(offset, dest, count);
+  }
+
+  mmio_read_calls.add();
+  mmio_read_regs.add(count);
+
+  auto dwords = reinterpret_cast<volatile uint32_t *>(address);
+  for (size_t i = 0; i < count; i++) {
+    reg_conv_t conv_value;
+    conv_value.half.hi = dwords[2 * i];
+    conv_value.half.lo = dwords[2 * i + 1];
+    dest[i] = conv_value.full;
+  }
+
+  LOGD("[AWSPlatform] Read " << std::dec << count << " regs from reg " << (2 * offset) << " addr " << STRHEX64
+                             << (4 * (2 * offset)));
+
+  return fletcher::OK;
+}
+
 int AWSPlatform::read_mmio(uint64_t offset, fr_t *dest) {
   if (!error) {
+    mmio_read_calls.add();
+    mmio_read_regs.add();
+
     int rc = 0;
     reg_conv_t conv_value;
     uint32_t ret = 0xDEADBEEF;
@@ -286,6 +415,10 @@ int AWSPlatform::read_mmio(uint64_t offset, fr_t *dest) {
   }
 }
 
+int AWSPlatform::numa_node() {
+  return node;
+}
+
 bool AWSPlatform::good() {
   return !error;
 }
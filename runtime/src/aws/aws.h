@@ -14,7 +14,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 #include <arrow/api.h>
@@ -22,9 +24,16 @@
 #include "../common.h"
 #include "../FPGAPlatform.h"
 #include "../UserCore.h"
+#include "../DeviceMemory.h"
+#include "../BufferCache.h"
+#include "../CopyEngine.h"
+#include "../Numa.h"
 
 #define AWS_QUEUE_THRESHOLD (1024*1024*1) // 1 MiB
 #define AWS_NUM_QUEUES 4
+#define AWS_EDMA_PATH_FORMAT "/dev/edma%i_queue_%i"
+#define AWS_DDR_SIZE (64UL*1024*1024*1024) // 64 GiB
+#define AWS_DDR_MIN_BLOCK 4096
 
 // Forward declarations:
 typedef int pci_bar_handle_t;
@@ -44,14 +53,86 @@ class AWSPlatform : public FPGAPlatform {
    * \param pf_id    The FPGA pf_id you want to use. Default is FPGA_APP_PF=0.
    * \param bar_id   The BAR id you want to use for the memory-mapped slave 
    *                 registers. Default is APP_PF_BAR1.
+   * \param edma_path_format The printf format of the EDMA queue device 
+   *                 files, given the slot ID and queue number.
+   * \param num_queues The number of EDMA queues to use.
    */
-  explicit AWSPlatform(int slot_id = 0, int pf_id = 0, int bar_id = 1);
+  explicit AWSPlatform(int slot_id = 0,
+                       int pf_id = 0,
+                       int bar_id = 1,
+                       const std::string &edma_path_format = AWS_EDMA_PATH_FORMAT,
+                       int num_queues = AWS_NUM_QUEUES);
 
   int write_mmio(uint64_t offset, fr_t value) override;
 
   int read_mmio(uint64_t offset, fr_t *dest) override;
 
-  void set_alignment(uint64_t alignment) {}
+  /**
+   * \brief Write a range of registers with a single burst.
+   *
+   * Falls back to writing the registers one by one if the BAR could not
+   * be attached for bursts, or if the burst fails.
+   */
+  int write_mmio_batch(uint64_t offset, const fr_t *values, size_t count) override;
+
+  /**
+   * \brief Read a range of registers directly from the mapped BAR.
+   */
+  int read_mmio_batch(uint64_t offset, fr_t *dest, size_t count) override;
+
+  uint64_t copy_from_device(fa_t address, uint8_t *dest, uint64_t bytes) override;
+
+  /**
+   * \brief Set the alignment of buffers in on-board memory. Must be a
+   * power of two.
+   */
+  void set_alignment(uint64_t alignment) { this->alignment = alignment; }
+
+  /**
+   * \brief Set the minimum number of bytes for which a copy to on-board
+   * memory is spread over all EDMA queues.
+   */
+  void set_queue_threshold(size_t threshold);
+
+  /**
+   * \brief Keep buffers resident in on-board memory after they are freed,
+   * such that organizing the same host buffers again skips the copy.
+   *
+   * Must be enabled before any buffers are organized. Buffers are
+   * identified by host address and size, and optionally by a fingerprint
+   * of their contents. Without fingerprints, call invalidate_cache() when
+   * host buffers may have been modified or reallocated.
+   */
+  void enable_cache(bool fingerprint = false);
+
+  /**
+   * \brief Drop all resident buffers from the cache.
+   */
+  void invalidate_cache();
+
+  /**
+   * \brief Return the statistics of the buffer cache.
+   */
+  CacheStats cache_stats();
+
+  /**
+   * \brief Returns the NUMA node of the socket the FPGA is attached to.
+   *
+   * The EDMA worker threads run on this node. Build tables in
+   * memory_pool() to keep their buffers on it as well.
+   */
+  int numa_node() override;
+
+  /**
+   * \brief Move host buffers to the NUMA node of the FPGA before copying
+   * them to on-board memory, if they are elsewhere.
+   *
+   * Moving pages costs about as much as a copy across sockets, so this
+   * only pays off for buffers that are copied more than once, e.g. when
+   * the cache is disabled or evicts them, or that are used by threads on
+   * the node of the FPGA afterwards.
+   */
+  void set_migrate_inputs(bool migrate) { this->migrate_inputs = migrate; }
 
   bool good() override;
 
@@ -61,20 +142,36 @@ class AWSPlatform : public FPGAPlatform {
   int pf_id;
   int bar_id;
   pci_bar_handle_t pci_bar_handle;
-  char device_filename[256];
-  int edma_fd[AWS_NUM_QUEUES];
+  /// Whether the BAR is mapped write-combined, as required by fpga_pci_write_burst
+  bool burst_capable = false;
+  int node = NUMA_NODE_NONE;
+  bool migrate_inputs = false;
+
+  /// Copy engine driving the EDMA queues
+  std::unique_ptr<CopyEngine> engine;
   uint64_t alignment = 4096;  // TODO: this should become 64 after Arrow spec.
 
+  /// Allocator for the on-board DDR memory
+  DeviceMemory ddr{0, AWS_DDR_SIZE, AWS_DDR_MIN_BLOCK};
+
+  /// Cache of buffers resident in on-board DDR memory, if enabled
+  std::unique_ptr<BufferCache> cache;
+
   size_t copy_to_ddr(uint8_t *source, fa_t offset, size_t size);
 
+  size_t copy_from_ddr(uint8_t *dest, fa_t offset, size_t size);
+
   int check_ddr(uint8_t *source, fa_t offset, size_t size);
 
   uint64_t organize_buffers(const std::vector<BufConfig> &source_buffers,
                             std::vector<BufConfig> &dest_buffers) override;
 
+  void free_buffers(const std::vector<BufConfig> &dest_buffers) override;
+
   int check_slot_config();
 
-  bool error = false;
+  // Registers are accessed through a mapped BAR, which needs no locking
+  std::atomic<bool> error{false};
 };
 
 }
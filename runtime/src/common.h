@@ -15,6 +15,9 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace fletcher {
 
@@ -35,8 +38,20 @@ typedef struct _BufConfig {
   fa_t address;
   int64_t size;     // Arrow makes this signed int
   int64_t capacity;  // This as well
+  std::shared_ptr<void> owner;  // Keeps memory allocated for this buffer alive, if any
 } BufConfig;
 
+/**
+ * A Chunk configuration element
+ *
+ * Holds the buffer configurations of one chunk of all prepared columns, in the
+ * order of the buffer address registers.
+ */
+typedef struct _ChunkConfig {
+  int64_t length;                  // Number of rows in this chunk
+  std::vector<BufConfig> buffers;  // Buffers of this chunk
+} ChunkConfig;
+
 /**
  * A structure to help in converting from 2x32 bit registers to 1x64 bit register and vice versa
  */
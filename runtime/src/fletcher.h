@@ -18,9 +18,28 @@
 #include "FPGAPlatform.h"
 #include "logging.h"
 #include "UserCore.h"
+#include "Job.h"
+#include "Poller.h"
+#include "Metrics.h"
+#include "Pipeline.h"
+#include "DeviceMemory.h"
+#include "BufferCache.h"
+#include "CopyEngine.h"
+#include "Numa.h"
+#include "DmaMemoryPool.h"
+#include "DevicePool.h"
+#include "HybridExecutor.h"
+#include "StreamRunner.h"
+// Unsupported prototype, of which the ring and its completion records run on the simulator only
+#include "CommandRing.h"
+#include "OutputColumn.h"
+#include "PlasmaSource.h"
 
 #include "aws/aws.h"
 #include "snap/snap.h"
 
 // The boilerplate code for FPGA platform implementation
-#include "echo/echo.h"
\ No newline at end of file
+#include "echo/echo.h"
+
+// Software simulation of a UserCore
+#include "sim/sim.h"
\ No newline at end of file
@@ -0,0 +1,218 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "logging.h"
+
+/// The number of log lines that can be queued, must be a power of two
+#define LOG_RING_SIZE 4096
+
+namespace fletcher {
+
+namespace {
+
+/**
+ * Bounded multi-producer, single-consumer ring of log lines.
+ *
+ * Every slot carries a sequence number that tells producers and the
+ * consumer whose turn it is, so neither takes a lock.
+ */
+class AsyncLog {
+ public:
+  AsyncLog() : slots(LOG_RING_SIZE) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    worker = std::thread(&AsyncLog::drain, this);
+  }
+
+  /// Queue a line, waiting for space if the ring is full
+  void push(std::ostream &stream, std::string &&line) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    while (true) {
+      if (stopped.load(std::memory_order_acquire)) {
+        // The background thread is gone, write directly
+        stream << line << std::flush;
+        return;
+      }
+
+      Slot &slot = slots[pos & (LOG_RING_SIZE - 1)];
+      size_t seq = slot.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          slot.stream = &stream;
+          slot.line = std::move(line);
+          slot.seq.store(pos + 1, std::memory_order_release);
+          wake();
+          return;
+        }
+      } else if (diff < 0) {
+        // Full; wait for the background thread rather than reorder or drop lines
+        std::this_thread::yield();
+        pos = head.load(std::memory_order_relaxed);
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Wait until every line queued so far has been written
+  void flush() {
+    size_t target = head.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this, target] {
+      return stopped.load(std::memory_order_acquire) || (written.load(std::memory_order_acquire) >= target);
+    });
+  }
+
+  /// Write all remaining lines and stop the background thread
+  void stop() {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopping.store(true, std::memory_order_release);
+    }
+    queued.notify_one();
+    if (worker.joinable()) {
+      worker.join();
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stopped.store(true, std::memory_order_release);
+    }
+    flushed.notify_all();
+
+    // Write lines that were queued while the background thread finished
+    std::ostream *stream;
+    std::string line;
+    while (pop(stream, line)) {
+      *stream << line << std::flush;
+    }
+  }
+
+ private:
+  typedef struct _Slot {
+    std::atomic<size_t> seq;
+    std::ostream *stream = nullptr;
+    std::string line;
+  } Slot;
+
+  std::vector<Slot> slots;
+
+  std::atomic<size_t> head{0};
+  size_t tail = 0;
+  std::atomic<size_t> written{0};
+
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> stopped{false};
+
+  /// Wakes the background thread when it sleeps, and threads waiting for a flush
+  std::mutex mutex;
+  std::condition_variable queued;
+  std::condition_variable flushed;
+  std::atomic<bool> sleeping{false};
+
+  std::thread worker;
+
+  /// Return true if the next line can be popped
+  bool ready() {
+    return slots[tail & (LOG_RING_SIZE - 1)].seq.load(std::memory_order_acquire) == tail + 1;
+  }
+
+  /// Wake the background thread after queueing a line. Only takes the lock if it sleeps.
+  void wake() {
+    // Orders the line before the check, against the fence in drain()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+      { std::lock_guard<std::mutex> guard(mutex); }
+      queued.notify_one();
+    }
+  }
+
+  bool pop(std::ostream *&stream, std::string &line) {
+    if (!ready()) {
+      return false;
+    }
+    Slot &slot = slots[tail & (LOG_RING_SIZE - 1)];
+    stream = slot.stream;
+    line = std::move(slot.line);
+    slot.seq.store(tail + LOG_RING_SIZE, std::memory_order_release);
+    tail++;
+    return true;
+  }
+
+  void drain() {
+    std::ostream *stream;
+    std::string line;
+
+    while (true) {
+      bool stopping_now = stopping.load(std::memory_order_acquire);
+
+      // Write everything that is queued, then flush once
+      size_t lines = 0;
+      while (pop(stream, line)) {
+        stream->write(line.data(), line.size());
+        lines++;
+      }
+
+      if (lines > 0) {
+        std::cout.flush();
+        std::cerr.flush();
+        {
+          std::lock_guard<std::mutex> guard(mutex);
+          written.fetch_add(lines, std::memory_order_release);
+        }
+        flushed.notify_all();
+      } else if (stopping_now) {
+        return;
+      } else {
+        // Sleep until a line is queued; producers check sleeping after queueing their line
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        queued.wait(lock, [this] { return ready() || stopping.load(std::memory_order_acquire); });
+        sleeping.store(false, std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+AsyncLog &async_log() {
+  // Never destroyed, so it can be used from static destructors; stopped at exit instead.
+  static AsyncLog *log = []() {
+    auto l = new AsyncLog();
+    std::atexit([]() { async_log().stop(); });
+    return l;
+  }();
+  return *log;
+}
+
+}
+
+void log_async(std::ostream &stream, std::string &&line) {
+  async_log().push(stream, std::move(line));
+}
+
+void log_flush() {
+  async_log().flush();
+}
+
+}
@@ -17,23 +17,81 @@
 #pragma once
 
 #include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/// Log levels. Messages below FLETCHER_LOG_LEVEL are compiled out entirely.
+#define FLETCHER_LOG_DEBUG 0
+#define FLETCHER_LOG_INFO  1
+#define FLETCHER_LOG_ERROR 2
+#define FLETCHER_LOG_NONE  3
+
+#ifndef FLETCHER_LOG_LEVEL
+#ifdef DEBUG
+#define FLETCHER_LOG_LEVEL FLETCHER_LOG_DEBUG
+#else
+#define FLETCHER_LOG_LEVEL FLETCHER_LOG_INFO
+#endif
+#endif
 
 #ifdef USE_BOOST_LOG
 #define BOOST_LOG_DYN_LINK 1
 #include <boost/log/trivial.hpp>
-#define LOGD(X) BOOST_LOG_TRIVIAL(debug) << X
-#define LOGI(X) BOOST_LOG_TRIVIAL(info) << X
-#define LOGE(X) BOOST_LOG_TRIVIAL(error) << X
+#define FLETCHER_LOG(LEVEL, STREAM, PREFIX, X) BOOST_LOG_TRIVIAL(LEVEL) << X
+#define FLETCHER_LOG_ERROR_LINE(STREAM, PREFIX, X) FLETCHER_LOG(error, STREAM, PREFIX, X)
+#elif defined(LOG_ASYNC)
+// Format on the calling thread, write on the background logging thread
+#define FLETCHER_LOG(LEVEL, STREAM, PREFIX, X) do { \
+    std::ostringstream fletcher_log_line; \
+    fletcher_log_line << PREFIX << X << '\n'; \
+    fletcher::log_async(STREAM, fletcher_log_line.str()); \
+  } while (false)
+// Errors are written before returning, such that they are not lost if the process dies, after the lines before them
+#define FLETCHER_LOG_ERROR_LINE(STREAM, PREFIX, X) do { \
+    fletcher::log_flush(); \
+    STREAM << PREFIX << X << std::endl; \
+  } while (false)
 #else
-#include <iostream>
-#ifdef DEBUG
-#define LOGD(X) std::cout << "DEBUG: " << X << std::endl
+#define FLETCHER_LOG(LEVEL, STREAM, PREFIX, X) STREAM << PREFIX << X << std::endl
+#define FLETCHER_LOG_ERROR_LINE(STREAM, PREFIX, X) FLETCHER_LOG(error, STREAM, PREFIX, X)
+#endif
+
+#if FLETCHER_LOG_LEVEL <= FLETCHER_LOG_DEBUG
+#define LOGD(X) FLETCHER_LOG(debug, std::cout, "DEBUG: ", X)
 #else
 #define LOGD(X) do {} while (false)
 #endif
-#define LOGI(X) std::cout << "INFO : " << X << std::endl
-#define LOGE(X) std::cerr << "ERROR: " << X << std::endl
+
+#if FLETCHER_LOG_LEVEL <= FLETCHER_LOG_INFO
+#define LOGI(X) FLETCHER_LOG(info, std::cout, "INFO : ", X)
+#else
+#define LOGI(X) do {} while (false)
+#endif
+
+#if FLETCHER_LOG_LEVEL <= FLETCHER_LOG_ERROR
+#define LOGE(X) FLETCHER_LOG_ERROR_LINE(std::cerr, "ERROR: ", X)
+#else
+#define LOGE(X) do {} while (false)
 #endif
 
+namespace fletcher {
+
+/**
+ * \brief Queue a formatted log line for a stream.
+ *
+ * The line is written by a background thread, so the caller never waits
+ * for the I/O unless the queue is full. Lines of the same thread keep
+ * their order. Errors are not queued.
+ */
+void log_async(std::ostream &stream, std::string &&line);
+
+/**
+ * \brief Wait until all queued log lines have been written.
+ */
+void log_flush();
+
+}
+
 #define STRHEX64 "0x" << std::hex << std::setfill('0') << std::setw(16)
 #define STRHEX32 "0x" << std::hex << std::setfill('0') << std::setw( 8)
@@ -0,0 +1,431 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <map>
+#include <stdexcept>
+
+#include <arrow/api.h>
+
+#include "../logging.h"
+#include "../CommandRing.h"
+#include "sim.h"
+
+namespace fletcher {
+
+namespace {
+
+std::map<std::string, SimPlatform::model_factory> &models() {
+  static std::map<std::string, SimPlatform::model_factory> registry;
+  return registry;
+}
+
+std::mutex &models_lock() {
+  static std::mutex lock;
+  return lock;
+}
+
+}
+
+SimPlatform::SimPlatform(std::shared_ptr<SimModel> model,
+                         SimTiming timing,
+                         size_t num_registers,
+                         size_t window_size)
+    : model(std::move(model)),
+      timing(timing),
+      registers(num_registers, 0),
+      window_size(window_size == 0 ? num_registers : window_size) {
+  LOGD("[SimPlatform] Platform created with " << num_registers << " registers.");
+
+  if (!this->model) {
+    LOGE("[SimPlatform] No model supplied. Entering error state.");
+    error = true;
+    return;
+  }
+
+  if ((this->window_size < UC_REG_BUFFERS) || (this->window_size > num_registers)) {
+    LOGE("[SimPlatform] Too few registers. Entering error state.");
+    error = true;
+    return;
+  }
+
+  // Registers beyond the last whole window belong to no UserCore
+  for (size_t offset = 0; offset + this->window_size <= num_registers; offset += this->window_size) {
+    std::unique_ptr<Window> window(new Window);
+    window->offset = offset;
+    windows.push_back(std::move(window));
+
+    registers[offset + UC_REG_STATUS] = this->model->status_idle();
+  }
+}
+
+SimPlatform::SimPlatform(const std::string &model_name, SimTiming timing, size_t num_registers, size_t window_size)
+    : SimPlatform(make_model(model_name), timing, num_registers, window_size) {}
+
+SimPlatform::~SimPlatform() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto &window : windows) {
+      window->stop = true;
+    }
+  }
+
+  for (auto &window : windows) {
+    window->stopped.notify_all();
+    if (window->worker.joinable()) {
+      window->worker.join();
+    }
+  }
+}
+
+uint64_t SimPlatform::organize_buffers(const std::vector<BufConfig> &source_buffers,
+                                       std::vector<BufConfig> &dest_buffers) {
+  uint64_t bytes = 0;
+
+  // The model reads the host buffers directly
+  for (auto const &src : source_buffers) {
+    bytes += src.size;
+    dest_buffers.push_back(src);
+  }
+
+  return bytes;
+}
+
+void SimPlatform::mmio_delay() {
+  if (timing.mmio_latency_nsec > 0) {
+    // Sleeping is far too coarse for the latency of a single transaction
+    auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timing.mmio_latency_nsec);
+    while (std::chrono::steady_clock::now() < until) {}
+  }
+}
+
+int SimPlatform::write_register(uint64_t offset, fr_t value) {
+  if (offset >= registers.size()) {
+    LOGE("[SimPlatform] Write to register " << offset << " out of range.");
+    return ERROR;
+  }
+
+  // The control and status registers are at the same place in every window
+  uint64_t index = offset / window_size;
+  Window *window = index < windows.size() ? windows[index].get() : nullptr;
+  uint64_t reg = offset % window_size;
+
+  if (window && (reg == UC_REG_CONTROL)) {
+    registers[offset] = value;
+    control(*window, value);
+  } else if (ring_enabled && (offset == ring_offset + RING_REG_CONSUMED)) {
+    // The consumed register is written by the device only
+  } else if (!window || (reg != UC_REG_STATUS)) {
+    // The status register is read-only
+    registers[offset] = value;
+
+    if (ring_enabled && (offset == ring_offset + RING_REG_BASE)) {
+      registers[ring_offset + RING_REG_CONSUMED] = 0;
+    } else if (ring_enabled && (offset == ring_offset + RING_REG_DOORBELL)) {
+      doorbell();
+    }
+  }
+
+  return OK;
+}
+
+void SimPlatform::doorbell() {
+  Window &window = *windows[0];
+
+  // A ring that is being processed, or a run that finishes, picks up the new commands by itself
+  if (window.busy) {
+    return;
+  }
+
+  // Writing the doorbell while configuring the ring rings it for no commands
+  if (registers[ring_offset + RING_REG_CONSUMED] >= registers[ring_offset + RING_REG_DOORBELL]) {
+    return;
+  }
+
+  if (window.worker.joinable()) {
+    window.worker.join();
+  }
+
+  window.busy = true;
+  window.stop = false;
+
+  window.worker = std::thread(&SimPlatform::process_ring, this, timing);
+}
+
+void SimPlatform::control(Window &window, fr_t value) {
+  fr_t &status = registers[window.offset + UC_REG_STATUS];
+
+  if ((value & model->control_reset()) || (value & model->control_stop())) {
+    if (window.busy) {
+      window.stop = true;
+      window.stopped.notify_all();
+    } else {
+      status = model->status_idle();
+    }
+  }
+
+  if (value & model->control_start()) {
+    if (window.busy) {
+      LOGE("[SimPlatform] UserCore at register " << window.offset << " started while busy. Ignoring.");
+      return;
+    }
+
+    // A worker that is no longer busy has released the lock for good
+    if (window.worker.joinable()) {
+      window.worker.join();
+    }
+
+    window.busy = true;
+    window.stop = false;
+    _runs++;
+    status = model->status_busy();
+
+    window.worker = std::thread(&SimPlatform::execute, this, &window, snapshot(window), timing);
+  }
+}
+
+std::vector<fr_t> SimPlatform::snapshot(const Window &window) {
+  auto first = registers.begin() + window.offset;
+  return std::vector<fr_t>(first, first + window_size);
+}
+
+void SimPlatform::execute(Window *window, std::vector<fr_t> snapshot, SimTiming run_timing) {
+  std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+  run_model(*window, std::move(snapshot), run_timing, guard);
+
+  // A doorbell rung during the run was ignored, as the platform was busy, so pick up its commands now
+  if ((window == windows[0].get()) && ring_enabled
+      && (registers[ring_offset + RING_REG_CONSUMED] < registers[ring_offset + RING_REG_DOORBELL])) {
+    guard.unlock();
+    process_ring(run_timing);
+    return;
+  }
+
+  window->busy = false;
+}
+
+void SimPlatform::process_ring(SimTiming run_timing) {
+  std::unique_lock<std::mutex> guard(lock);
+
+  // The commands run in the first window, which starts at register 0
+  Window &window = *windows[0];
+  const uint64_t consumed_reg = ring_offset + RING_REG_CONSUMED;
+
+  while (!window.stop && !error && (registers[consumed_reg] < registers[ring_offset + RING_REG_DOORBELL])) {
+    fr_t consumed = registers[consumed_reg];
+    fr_t slot_words = registers[ring_offset + RING_REG_SLOT_WORDS];
+
+    // Fetch the command from host memory
+    auto ring = reinterpret_cast<const fr_t *>(registers[ring_offset + RING_REG_BASE]);
+    const fr_t *slot = &ring[(consumed % registers[ring_offset + RING_REG_SLOTS]) * slot_words];
+
+    if ((slot[0] >= slot_words) || (UC_REG_BUFFERS + slot[0] > window_size)) {
+      LOGE("[SimPlatform] Command " << consumed << " of " << slot[0] << " registers is invalid. Entering error state.");
+      error = true;
+      break;
+    }
+
+    for (fr_t i = 0; i < slot[0]; i++) {
+      registers[UC_REG_BUFFERS + i] = slot[1 + i];
+    }
+
+    _runs++;
+    registers[UC_REG_STATUS] = model->status_busy();
+    std::vector<fr_t> registers_snapshot = snapshot(window);
+
+    guard.unlock();
+    if (!run_model(window, std::move(registers_snapshot), run_timing, guard)) {
+      break;
+    }
+
+    if (registers[ring_offset + RING_REG_CQ_BASE] != 0) {
+      fr_t first = registers[ring_offset + RING_REG_RESULTS];
+      fr_t num_results = registers[ring_offset + RING_REG_NUM_RESULTS];
+
+      if ((2 + num_results > slot_words) || (first + num_results > registers.size())) {
+        LOGE("[SimPlatform] Completion record of " << num_results << " results is invalid. Entering error state.");
+        error = true;
+        break;
+      }
+
+      // Write the completion record, with the sequence number last
+      auto records = reinterpret_cast<volatile fr_t *>(registers[ring_offset + RING_REG_CQ_BASE]);
+      volatile fr_t *record = &records[(consumed % registers[ring_offset + RING_REG_SLOTS]) * slot_words];
+
+      record[1] = registers[UC_REG_RETURN];
+      for (fr_t i = 0; i < num_results; i++) {
+        record[2 + i] = registers[first + i];
+      }
+      std::atomic_thread_fence(std::memory_order_release);
+      record[0] = consumed + 1;
+    }
+
+    registers[consumed_reg] = consumed + 1;
+  }
+
+  window.busy = false;
+}
+
+bool SimPlatform::run_model(Window &window,
+                            std::vector<fr_t> snapshot,
+                            SimTiming run_timing,
+                            std::unique_lock<std::mutex> &guard) {
+  auto begin = std::chrono::steady_clock::now();
+
+  std::vector<fr_t> original = snapshot;
+  uint64_t bytes = 0;
+  bool failed = false;
+
+  try {
+    bytes = model->run(snapshot);
+  } catch (const std::exception &e) {
+    LOGE("[SimPlatform] Model failed: " << e.what() << ". Entering error state.");
+    failed = true;
+  }
+
+  // The UserCore is done when the data would have been transferred
+  auto duration = std::chrono::microseconds(run_timing.latency_usec);
+  if (run_timing.bandwidth > 0.0) {
+    duration += std::chrono::microseconds(static_cast<uint64_t>(1E6 * bytes / run_timing.bandwidth));
+  }
+
+  guard.lock();
+  window.stopped.wait_until(guard, begin + duration, [&window]() { return window.stop; });
+
+  if (failed) {
+    error = true;
+  }
+
+  fr_t &status = registers[window.offset + UC_REG_STATUS];
+
+  if (!window.stop && !failed) {
+    // Write back the registers of the window written by the model
+    for (size_t r = 0; r < window_size; r++) {
+      if ((r != UC_REG_STATUS) && (r != UC_REG_CONTROL) && (r < snapshot.size()) && (snapshot[r] != original[r])) {
+        registers[window.offset + r] = snapshot[r];
+      }
+    }
+    status = model->status_done();
+  } else {
+    status = model->status_idle();
+  }
+
+  LOGD("[SimPlatform] Run " << _runs << " finished. Bytes: " << bytes);
+
+  return !window.stop && !failed;
+}
+
+void SimPlatform::enable_command_ring(uint64_t reg_offset) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  if (reg_offset + RING_NUM_REGS > registers.size()) {
+    throw std::runtime_error("Command ring registers at " + std::to_string(reg_offset) + " are out of range.");
+  }
+
+  ring_enabled = true;
+  ring_offset = reg_offset;
+  registers[ring_offset + RING_REG_CONSUMED] = 0;
+}
+
+bool SimPlatform::command_ring_supported() {
+  std::lock_guard<std::mutex> guard(lock);
+  return ring_enabled;
+}
+
+int SimPlatform::write_mmio(uint64_t offset, fr_t value) {
+  mmio_delay();
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (error) {
+    return ERROR;
+  }
+
+  return write_register(offset, value);
+}
+
+int SimPlatform::read_mmio(uint64_t offset, fr_t *dest) {
+  return read_mmio_batch(offset, dest, 1);
+}
+
+int SimPlatform::write_mmio_batch(uint64_t offset, const fr_t *values, size_t count) {
+  mmio_delay();
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (error) {
+    return ERROR;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (write_register(offset + i, values[i]) != OK) {
+      return ERROR;
+    }
+  }
+
+  return OK;
+}
+
+int SimPlatform::read_mmio_batch(uint64_t offset, fr_t *dest, size_t count) {
+  mmio_delay();
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (error) {
+    return ERROR;
+  }
+
+  if (offset + count > registers.size()) {
+    LOGE("[SimPlatform] Read from register " << offset + count - 1 << " out of range.");
+    return ERROR;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    dest[i] = registers[offset + i];
+  }
+
+  return OK;
+}
+
+bool SimPlatform::good() {
+  std::lock_guard<std::mutex> guard(lock);
+  return !error;
+}
+
+void SimPlatform::set_timing(SimTiming timing) {
+  std::lock_guard<std::mutex> guard(lock);
+  this->timing = timing;
+}
+
+uint64_t SimPlatform::runs() {
+  std::lock_guard<std::mutex> guard(lock);
+  return _runs;
+}
+
+void SimPlatform::register_model(const std::string &name, model_factory factory) {
+  std::lock_guard<std::mutex> guard(models_lock());
+  models()[name] = std::move(factory);
+}
+
+std::shared_ptr<SimModel> SimPlatform::make_model(const std::string &name) {
+  model_factory factory;
+  {
+    std::lock_guard<std::mutex> guard(models_lock());
+    auto it = models().find(name);
+    if (it == models().end()) {
+      throw std::runtime_error("No simulation model registered as " + name + ".");
+    }
+    factory = it->second;
+  }
+  return factory();
+}
+
+}//namespace fletcher
@@ -0,0 +1,245 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "../FPGAPlatform.h"
+
+/// The default number of registers of a SimPlatform
+#define SIM_DEFAULT_REGISTERS 256
+
+namespace fletcher {
+
+/**
+ * \class SimModel
+ * \brief Functional model of a UserCore, executed by a SimPlatform.
+ *
+ * The model sees the register file as the UserCore would: buffer addresses
+ * start at UC_REG_BUFFERS and are host addresses, followed by the
+ * arguments. The encoding of the control and status registers defaults to
+ * the one in FPGAPlatform.h, but may be overridden for UserCores that
+ * use another encoding.
+ */
+class SimModel {
+ public:
+  virtual ~SimModel() = default;
+
+  /**
+   * \brief Execute the function of the UserCore.
+   *
+   * \param registers A copy of the register file. The model may write its
+   *                  results to it, e.g. to UC_REG_RETURN. Registers that
+   *                  are changed by the model are written back.
+   * \return the number of bytes the UserCore would transfer between host
+   * memory and the FPGA, used to model the bandwidth.
+   */
+  virtual uint64_t run(std::vector<fr_t> &registers) = 0;
+
+  /// Control register bits that start the UserCore
+  virtual fr_t control_start() { return 1UL << UC_REG_CONTROL_START; }
+
+  /// Control register bits that reset the UserCore
+  virtual fr_t control_reset() { return 1UL << UC_REG_CONTROL_RESET; }
+
+  /// Control register bits that stop the UserCore
+  virtual fr_t control_stop() { return 1UL << UC_REG_CONTROL_STOP; }
+
+  /// Status register value while idle
+  virtual fr_t status_idle() { return 1UL << UC_REG_STATUS_IDLE; }
+
+  /// Status register value while busy
+  virtual fr_t status_busy() { return 1UL << UC_REG_STATUS_BUSY; }
+
+  /// Status register value when done
+  virtual fr_t status_done() { return 1UL << UC_REG_STATUS_DONE; }
+};
+
+/**
+ * \brief Timing parameters of a SimPlatform.
+ */
+typedef struct _SimTiming {
+  /// Time between starting the UserCore and the first data transfer
+  uint64_t latency_usec = 0;
+  /// Bandwidth between host memory and the FPGA in bytes per second, 0 for unlimited
+  double bandwidth = 0.0;
+  /// Time spent on every MMIO read or write call
+  uint64_t mmio_latency_nsec = 0;
+} SimTiming;
+
+/**
+ * \class SimPlatform
+ * \brief A platform that executes a C++ functional model of a UserCore.
+ *
+ * Like on platforms with shared virtual memory, the buffers stay in host
+ * memory. Starting the UserCore runs the model on a separate thread.
+ * The status register reports busy until the model has finished, and the
+ * time it would take to transfer its data has passed.
+ *
+ * The registers may be divided into register windows of equal size, each
+ * of which behaves as a separate UserCore running the same model. The
+ * model sees the registers of its window only, so the same model works in
+ * every window. Models of several windows may run at the same time.
+ */
+class SimPlatform : public FPGAPlatform {
+ public:
+  typedef std::function<std::shared_ptr<SimModel>()> model_factory;
+
+  /**
+   * \param model         The functional model of the UserCore.
+   * \param timing        The timing parameters.
+   * \param num_registers The number of 64-bit registers.
+   * \param window_size   The number of registers of every register window,
+   *                      starting at register 0, or 0 for a single window
+   *                      of all registers.
+   */
+  explicit SimPlatform(std::shared_ptr<SimModel> model,
+                       SimTiming timing = SimTiming(),
+                       size_t num_registers = SIM_DEFAULT_REGISTERS,
+                       size_t window_size = 0);
+
+  /**
+   * \brief Construct a SimPlatform with a model that was registered under
+   * some name with register_model().
+   */
+  explicit SimPlatform(const std::string &model_name,
+                       SimTiming timing = SimTiming(),
+                       size_t num_registers = SIM_DEFAULT_REGISTERS,
+                       size_t window_size = 0);
+
+  ~SimPlatform() override;
+
+  int write_mmio(uint64_t offset, fr_t value) override;
+
+  int read_mmio(uint64_t offset, fr_t *dest) override;
+
+  int write_mmio_batch(uint64_t offset, const fr_t *values, size_t count) override;
+
+  int read_mmio_batch(uint64_t offset, fr_t *dest, size_t count) override;
+
+  bool good() override;
+
+  bool host_memory_access() override { return true; }
+
+  /**
+   * \brief Fetch commands from a CommandRing with its registers at some
+   * offset, like a UserCore controller with a command ring would.
+   *
+   * The commands are run one after the other in register window 0, for as
+   * long as the consumed register is behind the doorbell register.
+   */
+  void enable_command_ring(uint64_t reg_offset);
+
+  /**
+   * \brief Returns true once enable_command_ring() was called.
+   */
+  bool command_ring_supported() override;
+
+  /**
+   * \brief Change the timing parameters. Applies to the next run.
+   */
+  void set_timing(SimTiming timing);
+
+  /**
+   * \brief Return the number of times the model was run.
+   */
+  uint64_t runs();
+
+  /**
+   * \brief Register a factory of models under some name.
+   */
+  static void register_model(const std::string &name, model_factory factory);
+
+  /**
+   * \brief Create a model that was registered under some name.
+   * \throws std::runtime_error if no model was registered under that name.
+   */
+  static std::shared_ptr<SimModel> make_model(const std::string &name);
+
+ private:
+  std::string _name = "Simulation";
+
+  std::shared_ptr<SimModel> model;
+  SimTiming timing;
+
+  std::vector<fr_t> registers;
+
+  /// A register window, of which the model runs on its own thread
+  typedef struct _Window {
+    uint64_t offset;
+    std::thread worker;
+    std::condition_variable stopped;
+    bool busy = false;
+    bool stop = false;
+  } Window;
+
+  size_t window_size;
+  std::vector<std::unique_ptr<Window>> windows;
+
+  std::mutex lock;
+
+  bool error = false;
+  uint64_t _runs = 0;
+
+  bool ring_enabled = false;
+  uint64_t ring_offset = 0;
+
+  uint64_t organize_buffers(const std::vector<BufConfig> &source_buffers,
+                            std::vector<BufConfig> &dest_buffers) override;
+
+  /// Model the time spent on an MMIO call
+  void mmio_delay();
+
+  /// Write a single register; called with lock held
+  int write_register(uint64_t offset, fr_t value);
+
+  /// Handle a write to the control register of a window; called with lock held
+  void control(Window &window, fr_t value);
+
+  /// Handle a write to the doorbell register of the command ring; called with lock held
+  void doorbell();
+
+  /// Return a copy of the registers of a window; called with lock held
+  std::vector<fr_t> snapshot(const Window &window);
+
+  /// Run the model on a snapshot of a window, then the commands rung in meanwhile
+  void execute(Window *window, std::vector<fr_t> snapshot, SimTiming run_timing);
+
+  /// Run the commands in the command ring
+  void process_ring(SimTiming run_timing);
+
+  /**
+   * Run the model on a snapshot of the registers of a window, wait for the
+   * modeled duration and write back the results. Called without the lock
+   * held; returns with guard locked. Returns false if the run failed or was
+   * stopped.
+   */
+  bool run_model(Window &window,
+                 std::vector<fr_t> snapshot,
+                 SimTiming run_timing,
+                 std::unique_lock<std::mutex> &guard);
+};
+
+}//namespace fletcher
@@ -20,6 +20,9 @@
 #include <arrow/api.h>
 
 #include "../logging.h"
+#include "../DmaMemoryPool.h"
+#include "../Metrics.h"
+#include "../Numa.h"
 #include "../snap/snap.h"
 
 extern "C" {
@@ -28,6 +31,19 @@ extern "C" {
 
 namespace fletcher {
 
+static Counter &mmio_write_calls = Metrics::global().counter("fletcher_mmio_calls_total",
+                                                            "Number of MMIO calls.",
+                                                            "platform=\"snap\",op=\"write\"");
+static Counter &mmio_read_calls = Metrics::global().counter("fletcher_mmio_calls_total",
+                                                           "Number of MMIO calls.",
+                                                           "platform=\"snap\",op=\"read\"");
+static Counter &mmio_write_regs = Metrics::global().counter("fletcher_mmio_registers_total",
+                                                           "Number of 64-bit registers accessed over MMIO.",
+                                                           "platform=\"snap\",op=\"write\"");
+static Counter &mmio_read_regs = Metrics::global().counter("fletcher_mmio_registers_total",
+                                                          "Number of 64-bit registers accessed over MMIO.",
+                                                          "platform=\"snap\",op=\"read\"");
+
 SNAPPlatform::SNAPPlatform(int card_no, uint32_t action_type, bool sim) {
   LOGD("Setting up SNAP platform.");
 
@@ -43,6 +59,10 @@ SNAPPlatform::SNAPPlatform(int card_no, uint32_t action_type, bool sim) {
   }
 
   sprintf(device, "/dev/cxl/afu%d.0s", card_no);
+
+  // The card reads buffers from host memory, preferably on its own socket
+  node = numa_node_from_sysfs("/sys/class/cxl/card" + std::to_string(card_no) + "/device/numa_node");
+  LOGD("SNAP card " << card_no << " is attached to NUMA node " << node);
   card_handle = snap_card_alloc_dev(device, SNAP_VENDOR_ID_IBM, SNAP_DEVICE_ID_SNAP);
 
   if (card_handle == NULL) {
@@ -83,18 +103,15 @@ uint64_t SNAPPlatform::organize_buffers(const std::vector<BufConfig> &source_buf
                                         std::vector<BufConfig> &dest_buffers) {
   uint64_t bytes = 0;
 
-  int buf = 0;
-
   // Simply copy the source to the destination BufConfigs
   // as in SNAP the FPGA can access the host memory
   // using an address translation service.
   for (auto const &src : source_buffers) {
+    if (!DmaMemoryPool::is_dma_ready(reinterpret_cast<const void *>(src.address), src.capacity)) {
+      LOGD("[SNAPPlatform] Buffer " << src.name << " was not allocated from a DmaMemoryPool and may be paged out.");
+    }
     bytes += src.size;
     dest_buffers.push_back(src);
-
-    // Write the buffer config to the user core
-    write_mmio(UC_REG_BUFFERS + buf, src.address);
-    buf++;
   }
 
   return bytes;
@@ -102,9 +119,14 @@ uint64_t SNAPPlatform::organize_buffers(const std::vector<BufConfig> &source_buf
 
 inline int SNAPPlatform::write_mmio(uint64_t offset, fr_t value) {
   if (!error) {
+    mmio_write_calls.add();
+    mmio_write_regs.add();
+
     reg_conv_t conv_value;
     conv_value.full = value;
 
+    std::lock_guard<std::mutex> guard(mmio_lock);
+
     LOGD("Writing to MMIO reg HI " << std::dec << offset << " @ " << 4 * (2 * (SNAP_ACTION_REG_OFFSET + offset))
                                    << " value: " << STRHEX32 << conv_value.half.hi);
     snap_mmio_write32(card_handle, 4 * (2 * (SNAP_ACTION_REG_OFFSET + offset)), conv_value.half.hi);
@@ -126,6 +148,11 @@ inline int SNAPPlatform::read_mmio(uint64_t offset, fr_t *dest) {
   uint32_t ret = 0xDEADBEEF;
 
   if (!error) {
+    mmio_read_calls.add();
+    mmio_read_regs.add();
+
+    std::lock_guard<std::mutex> guard(mmio_lock);
+
     snap_mmio_read32(card_handle, 4 * (2 * (SNAP_ACTION_REG_OFFSET + offset)), &ret);
     conv_value.half.hi = ret;
 
@@ -145,6 +172,10 @@ inline int SNAPPlatform::read_mmio(uint64_t offset, fr_t *dest) {
   return fletcher::OK;
 }
 
+int SNAPPlatform::numa_node() {
+  return node;
+}
+
 bool SNAPPlatform::good() {
   return !error;
 }
@@ -14,7 +14,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <vector>
 
 #include <arrow/api.h>
@@ -48,6 +50,10 @@ class SNAPPlatform : public FPGAPlatform
 
   void set_alignment(uint64_t alignment);
 
+  bool host_memory_access() { return true; }
+
+  int numa_node();
+
   bool good();
 
  private:
@@ -56,11 +62,17 @@ class SNAPPlatform : public FPGAPlatform
   uint64_t organize_buffers(const std::vector<BufConfig> &source_buffers,
                             std::vector<BufConfig> &dest_buffers);
 
-  bool error = false;
+  std::atomic<bool> error{false};
+
+  // Serializes MMIO; the PSLSE simulation behind libsnap does not support concurrent access
+  std::mutex mmio_lock;
 
   // Snap device path
   char device[64];
 
+  // NUMA node of the card
+  int node = NUMA_NODE_NONE;
+
   // Snap card handle
   struct snap_card *card_handle;
 
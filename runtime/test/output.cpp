@@ -0,0 +1,80 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs a UserCore that writes a string column on the simulator. Its values overflow the estimate, after which the
+// column grows and the UserCore runs again.
+
+#include <algorithm>
+
+#include "OutputColumn.h"
+#include "UserCore.h"
+#include "sim/sim.h"
+#include "test.h"
+
+using namespace fletcher;
+
+/// Registers of the model: the offsets and values of the column, then the arguments
+#define REG_OFFSETS  (UC_REG_BUFFERS + 0)
+#define REG_VALUES   (UC_REG_BUFFERS + 1)
+#define REG_LENGTH   (UC_REG_BUFFERS + 2)
+#define REG_CAPACITY (UC_REG_BUFFERS + 3)
+
+/// Writes "abc" to every row, without writing values beyond the capacity, but always writing all offsets
+class AbcModel : public SimModel {
+ public:
+  uint64_t run(std::vector<fr_t> &registers) override {
+    auto offsets = reinterpret_cast<int32_t *>(registers[REG_OFFSETS]);
+    auto values = reinterpret_cast<char *>(registers[REG_VALUES]);
+    auto length = static_cast<int32_t>(registers[REG_LENGTH]);
+    auto capacity = static_cast<int32_t>(registers[REG_CAPACITY]);
+
+    for (int32_t i = 0; i <= length; i++) {
+      offsets[i] = 3 * i;
+    }
+    for (int32_t c = 0; (c < 3 * length) && (c < capacity); c++) {
+      values[c] = "abc"[c % 3];
+    }
+
+    return (length + 1) * sizeof(int32_t) + std::min(3 * length, capacity);
+  }
+};
+
+int main() {
+  auto platform = std::make_shared<SimPlatform>(std::make_shared<AbcModel>());
+  UserCore usercore(platform);
+
+  // Five rows of an estimated four characters in total, where the UserCore writes fifteen
+  OutputColumn column(platform, arrow::field("abc", arrow::utf8(), false), 5, 4);
+  CHECK(column.buffers().size() == 2);
+  CHECK(column.capacities()[1] == 4);
+
+  auto arguments = [](OutputColumn &output) -> std::vector<fr_t> {
+    return {static_cast<fr_t>(output.length()), output.capacities()[1]};
+  };
+  CHECK(column.run(usercore, {}, arguments) == SUCCESS);
+
+  // The first run overflowed, after which the values were grown to fit
+  CHECK(platform->runs() == 2);
+  CHECK(column.capacities()[1] >= 15);
+
+  auto array = std::static_pointer_cast<arrow::StringArray>(column.finalize());
+  CHECK(array->length() == 5);
+  for (int64_t i = 0; i < array->length(); i++) {
+    int32_t length = 0;
+    const uint8_t *value = array->GetValue(i, &length);
+    CHECK(std::string(reinterpret_cast<const char *>(value), static_cast<size_t>(length)) == "abc");
+  }
+
+  return EXIT_SUCCESS;
+}
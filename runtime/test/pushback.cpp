@@ -0,0 +1,172 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lets a simulated device fail, or the function collecting its results throw, while running ranges of a table with
+// a DevicePool and a HybridExecutor. The ranges of the failed device must be processed by the others.
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "DevicePool.h"
+#include "HybridExecutor.h"
+#include "UserCore.h"
+#include "sim/sim.h"
+#include "test.h"
+
+using namespace fletcher;
+
+/// Registers of the model: the number values, name offsets and name values, then the arguments
+#define REG_NUMBERS (UC_REG_BUFFERS + 0)
+#define REG_FIRST   (UC_REG_BUFFERS + 3)
+#define REG_LAST    (UC_REG_BUFFERS + 4)
+
+static const int64_t NUM_ROWS = 100;
+static const fr_t NUMBERS_SUM = 4950;
+
+/// Returns the sum of the numbers of a range of rows, or fails if it is a broken device
+class RangeSumModel : public SimModel {
+ public:
+  explicit RangeSumModel(bool broken = false) : broken(broken) {}
+
+  uint64_t run(std::vector<fr_t> &registers) override {
+    if (broken) {
+      throw std::runtime_error("Broken device.");
+    }
+
+    auto numbers = reinterpret_cast<const uint32_t *>(registers[REG_NUMBERS]);
+    fr_t sum = 0;
+    for (fr_t i = registers[REG_FIRST]; i < registers[REG_LAST]; i++) {
+      sum += numbers[i];
+    }
+    registers[UC_REG_RETURN] = sum;
+
+    return (registers[REG_LAST] - registers[REG_FIRST]) * sizeof(uint32_t);
+  }
+
+ private:
+  bool broken;
+};
+
+static std::vector<fr_t> range_arguments(const RowRange &range) {
+  return {static_cast<fr_t>(range.first), static_cast<fr_t>(range.last)};
+}
+
+static std::shared_ptr<DevicePool> make_pool(const std::shared_ptr<arrow::RecordBatch> &batch, int broken_device) {
+  std::vector<std::shared_ptr<FPGAPlatform>> platforms;
+  for (int d = 0; d < 3; d++) {
+    auto platform = std::make_shared<SimPlatform>(std::make_shared<RangeSumModel>(d == broken_device));
+    platform->prepare_recordbatch(batch);
+    platforms.push_back(platform);
+  }
+
+  return std::make_shared<DevicePool>(platforms, [](std::shared_ptr<FPGAPlatform> platform) {
+    return std::make_shared<UserCore>(platform);
+  });
+}
+
+static void pool_failed_device() {
+  auto batch = test::numbers_and_names(NUM_ROWS);
+  auto pool = make_pool(batch, 2);
+
+  fr_t sum = 0;
+  int64_t rows = 0;
+  auto arguments = [](size_t, const RowRange &range) { return range_arguments(range); };
+  auto done = [&](size_t, UserCore &usercore, const RowRange &range) {
+    sum += usercore.get_return();
+    rows += range.last - range.first;
+  };
+
+  CHECK(pool->run(10, arguments, done) == SUCCESS);
+  CHECK(pool->stats()[2].failed);
+  CHECK(pool->stats()[2].ranges == 0);
+  CHECK(rows == NUM_ROWS);
+  CHECK(sum == NUMBERS_SUM);
+}
+
+static void pool_throwing_done() {
+  auto batch = test::numbers_and_names(NUM_ROWS);
+  auto pool = make_pool(batch, -1);
+
+  fr_t sum = 0;
+  auto arguments = [](size_t, const RowRange &range) { return range_arguments(range); };
+  auto done = [&](size_t device, UserCore &usercore, const RowRange &) {
+    if (device == 1) {
+      throw std::runtime_error("Could not collect the results.");
+    }
+    sum += usercore.get_return();
+  };
+
+  bool thrown = false;
+  try {
+    pool->run(10, arguments, done);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+
+  CHECK(thrown);
+  CHECK(pool->stats()[1].failed);
+  CHECK(sum == NUMBERS_SUM);
+}
+
+static void hybrid(bool broken, bool throwing_done) {
+  auto batch = test::numbers_and_names(NUM_ROWS);
+  auto numbers = reinterpret_cast<const uint32_t *>(batch->column_data(0)->buffers[1]->data());
+
+  auto platform = std::make_shared<SimPlatform>(std::make_shared<RangeSumModel>(broken));
+  platform->prepare_recordbatch(batch);
+  UserCore usercore(platform);
+
+  HybridExecutor executor(platform, usercore, 2);
+  executor.set_fpga_ranges(4);
+
+  std::atomic<fr_t> sum(0);
+  auto fpga_done = [&](UserCore &core, const RowRange &) {
+    if (throwing_done) {
+      throw std::runtime_error("Could not collect the results.");
+    }
+    sum += core.get_return();
+  };
+  auto cpu = [&](size_t, const RowRange &range) {
+    // Much slower than the simulated device, such that the device takes at least one range
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    for (int64_t i = range.first; i < range.last; i++) {
+      sum += numbers[i];
+    }
+  };
+
+  bool thrown = false;
+  try {
+    CHECK(executor.run(10, range_arguments, fpga_done, cpu) == SUCCESS);
+  } catch (const std::runtime_error &) {
+    thrown = true;
+  }
+
+  CHECK(thrown == throwing_done);
+  CHECK(sum == NUMBERS_SUM);
+  if (broken) {
+    CHECK(executor.stats().fpga_rows == 0);
+    CHECK(executor.stats().cpu_rows == NUM_ROWS);
+  }
+}
+
+int main() {
+  pool_failed_device();
+  pool_throwing_done();
+  hybrid(false, false);
+  hybrid(true, false);
+  hybrid(false, true);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,105 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Runs UserCores in several register windows, and through a command ring with completion records, on the simulator.
+
+#include "CommandRing.h"
+#include "UserCore.h"
+#include "sim/sim.h"
+#include "test.h"
+
+using namespace fletcher;
+
+/// The ring registers, and the result registers included in the completion records
+#define RING_OFFSET   100
+#define RESULT_OFFSET 50
+#define NUM_RESULTS   2
+
+/// Returns twice its first register, and writes the register plus one and a constant to the result registers
+class TwiceModel : public SimModel {
+ public:
+  uint64_t run(std::vector<fr_t> &registers) override {
+    registers[UC_REG_RETURN] = 2 * registers[UC_REG_BUFFERS];
+    registers[RESULT_OFFSET] = registers[UC_REG_BUFFERS] + 1;
+    registers[RESULT_OFFSET + 1] = 7;
+    return 0;
+  }
+};
+
+static void windows() {
+  SimTiming timing;
+  timing.latency_usec = 20000;
+
+  // Four windows of 64 registers; the UserCores in windows 0 and 2 run at the same time
+  auto platform = std::make_shared<SimPlatform>(std::make_shared<TwiceModel>(), timing, 256, 64);
+  UserCore first(platform, 0);
+  UserCore third(platform, 128);
+
+  CHECK(platform->write_mmio(UC_REG_BUFFERS, 5) == OK);
+  CHECK(platform->write_mmio(128 + UC_REG_BUFFERS, 21) == OK);
+
+  CHECK(first.start() == SUCCESS);
+  CHECK(third.start() == SUCCESS);
+  CHECK(first.wait_for_finish() == SUCCESS);
+  CHECK(third.wait_for_finish() == SUCCESS);
+
+  // The model wrote the registers of its own window only
+  fr_t result = 0;
+  CHECK(first.get_return() == 10);
+  CHECK(third.get_return() == 42);
+  CHECK(platform->read_mmio(128 + RESULT_OFFSET, &result) == OK);
+  CHECK(result == 22);
+  CHECK(platform->read_mmio(64 + RESULT_OFFSET, &result) == OK);
+  CHECK(result == 0);
+  CHECK(platform->runs() == 2);
+}
+
+static void ring_wrap_around() {
+  auto platform = std::make_shared<SimPlatform>(std::make_shared<TwiceModel>());
+  platform->enable_command_ring(RING_OFFSET);
+
+  // Four slots, such that the commands below wrap around the ring several times
+  CommandRing ring(platform, RING_OFFSET, 4, 4);
+  CHECK(ring.good());
+  CHECK(ring.enable_completions(RESULT_OFFSET, NUM_RESULTS) == OK);
+
+  // One at a time, reading every completion record before its slot is reused
+  for (fr_t i = 0; i < 10; i++) {
+    uint64_t sequence = ring.push({}, {i});
+    CHECK(ring.submit() == OK);
+    CHECK(ring.wait(sequence) == SUCCESS);
+
+    auto record = ring.record(sequence);
+    CHECK(record.sequence == sequence);
+    CHECK(record.return_value == 2 * i);
+    CHECK(record.results.size() == NUM_RESULTS);
+    CHECK(record.results[0] == i + 1);
+    CHECK(record.results[1] == 7);
+  }
+
+  // More commands than slots at once, such that pushing submits them and waits for the device to free slots
+  for (fr_t i = 0; i < 9; i++) {
+    ring.push({}, {i});
+  }
+  CHECK(ring.submit() == OK);
+  CHECK(ring.wait_all() == SUCCESS);
+  CHECK(ring.completed() == 19);
+  CHECK(platform->runs() == 19);
+}
+
+int main() {
+  windows();
+  ring_wrap_around();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Prepares and activates a sliced RecordBatch on the simulator. The model sees only the rows of the slice.
+
+#include <stdexcept>
+
+#include "UserCore.h"
+#include "sim/sim.h"
+#include "test.h"
+
+using namespace fletcher;
+
+/// Registers of the model: the number values, name offsets and name values, then the arguments
+#define REG_NUMBERS      (UC_REG_BUFFERS + 0)
+#define REG_NAME_OFFSETS (UC_REG_BUFFERS + 1)
+#define REG_NAME_VALUES  (UC_REG_BUFFERS + 2)
+#define REG_LENGTH       (UC_REG_BUFFERS + 3)
+#define REG_CHARS        (UC_REG_BUFFERS + 4)
+
+/// Returns the sum of the numbers, and writes the number of characters of the names to REG_CHARS
+class SumModel : public SimModel {
+ public:
+  uint64_t run(std::vector<fr_t> &registers) override {
+    auto numbers = reinterpret_cast<const uint32_t *>(registers[REG_NUMBERS]);
+    auto offsets = reinterpret_cast<const int32_t *>(registers[REG_NAME_OFFSETS]);
+    auto values = reinterpret_cast<const char *>(registers[REG_NAME_VALUES]);
+    auto length = static_cast<int64_t>(registers[REG_LENGTH]);
+
+    if (offsets[0] != 0) {
+      throw std::runtime_error("The offsets of the slice do not start at 0.");
+    }
+
+    fr_t sum = 0;
+    for (int64_t i = 0; i < length; i++) {
+      sum += numbers[i];
+      for (int32_t c = offsets[i]; c < offsets[i + 1]; c++) {
+        if (values[c] != 'x') {
+          throw std::runtime_error("The values of the slice are not those of the names.");
+        }
+      }
+    }
+
+    registers[UC_REG_RETURN] = sum;
+    registers[REG_CHARS] = static_cast<fr_t>(offsets[length]);
+
+    return length * sizeof(uint32_t) + (length + 1) * sizeof(int32_t) + offsets[length];
+  }
+};
+
+/// Rows 30 to 70 of 100 rows: the numbers 30 to 69, and ten times names of 2, 3, 0 and 1 characters
+static const int64_t SLICE_OFFSET = 30;
+static const int64_t SLICE_LENGTH = 40;
+static const fr_t SLICE_SUM = 1980;
+static const fr_t SLICE_CHARS = 60;
+
+static void check_result(const std::shared_ptr<SimPlatform> &platform, UserCore &usercore) {
+  fr_t chars = 0;
+  CHECK(platform->read_mmio(REG_CHARS, &chars) == OK);
+  CHECK(usercore.get_return() == SLICE_SUM);
+  CHECK(chars == SLICE_CHARS);
+}
+
+static void prepared_slice() {
+  auto batch = test::numbers_and_names(100)->Slice(SLICE_OFFSET, SLICE_LENGTH);
+  auto platform = std::make_shared<SimPlatform>(std::make_shared<SumModel>());
+  UserCore usercore(platform);
+
+  platform->prepare_recordbatch(batch);
+  CHECK(platform->num_chunks() == 1);
+  CHECK(platform->chunk_config(0).length == SLICE_LENGTH);
+  CHECK(platform->argument_offset() == REG_LENGTH);
+
+  auto arguments = [](size_t, const ChunkConfig &chunk) -> std::vector<fr_t> {
+    return {static_cast<fr_t>(chunk.length)};
+  };
+  CHECK(usercore.run_chunks(arguments) == SUCCESS);
+  check_result(platform, usercore);
+}
+
+static void activated_slice() {
+  auto batch = test::numbers_and_names(100)->Slice(SLICE_OFFSET, SLICE_LENGTH);
+  auto platform = std::make_shared<SimPlatform>(std::make_shared<SumModel>());
+  UserCore usercore(platform);
+
+  std::vector<BufConfig> staged;
+  platform->stage_recordbatch(batch, staged);
+  CHECK(staged.size() == 3);
+
+  CHECK(usercore.reset() == SUCCESS);
+  CHECK(usercore.activate_buffers(staged) == SUCCESS);
+  CHECK(usercore.set_arguments({static_cast<fr_t>(SLICE_LENGTH)}) == SUCCESS);
+  CHECK(usercore.start() == SUCCESS);
+  CHECK(usercore.wait_for_finish() == SUCCESS);
+  check_result(platform, usercore);
+
+  platform->release_buffers(staged);
+}
+
+int main() {
+  prepared_slice();
+  activated_slice();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+// Copyright 2018 Delft University of Technology
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+
+/// Check a condition, also in release builds, and fail the test if it does not hold
+#define CHECK(condition)                                                                      \
+  do {                                                                                        \
+    if (!(condition)) {                                                                       \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": Check failed: " #condition << std::endl; \
+      std::exit(EXIT_FAILURE);                                                                \
+    }                                                                                         \
+  } while (0)
+
+namespace fletcher {
+namespace test {
+
+/// Allocate a buffer of some number of bytes, or fail the test
+inline std::shared_ptr<arrow::Buffer> allocate(int64_t size) {
+  std::shared_ptr<arrow::Buffer> buffer;
+  CHECK(arrow::AllocateBuffer(arrow::default_memory_pool(), size, &buffer).ok());
+  return buffer;
+}
+
+/**
+ * \brief Return a RecordBatch of length rows, with a uint32 column "number"
+ * holding the row index, and a utf8 column "name" holding a string of
+ * (row index % 4) characters 'x'.
+ */
+inline std::shared_ptr<arrow::RecordBatch> numbers_and_names(int64_t length) {
+  auto numbers = allocate(length * sizeof(uint32_t));
+  auto offsets = allocate((length + 1) * sizeof(int32_t));
+  auto values = allocate(3 * length);
+
+  auto number = reinterpret_cast<uint32_t *>(numbers->mutable_data());
+  auto offset = reinterpret_cast<int32_t *>(offsets->mutable_data());
+  offset[0] = 0;
+  for (int64_t i = 0; i < length; i++) {
+    number[i] = static_cast<uint32_t>(i);
+    offset[i + 1] = offset[i] + static_cast<int32_t>(i % 4);
+  }
+  memset(values->mutable_data(), 'x', static_cast<size_t>(offset[length]));
+
+  auto number_data = arrow::ArrayData::Make(arrow::uint32(), length, {nullptr, numbers}, 0);
+  auto name_data = arrow::ArrayData::Make(arrow::utf8(), length, {nullptr, offsets, values}, 0);
+
+  auto schema = arrow::schema({arrow::field("number", arrow::uint32(), false),
+                               arrow::field("name", arrow::utf8(), false)});
+
+  return arrow::RecordBatch::Make(schema, length, {arrow::MakeArray(number_data), arrow::MakeArray(name_data)});
+}
+
+}
+}